@@ -88,6 +88,8 @@ int freeMemory() {
 #include "mode_fsm.h"
 #include "recording.h"
 #include "accurate_timing.h"
+#include "diagnostics.h"
+#include "serial_log.h"
 
 /* *************************** (Defining Global Variables) ************************** */
 // - SENSOR
@@ -173,15 +175,15 @@ void clear_display();
 #include <Fsm.h>
 
 // *****************************************************
-State mode0(&mode0_run, NULL, NULL);
+State mode0(&mode0_setup, &mode0_loop, NULL);
 State mode1(&clear_display, &mode1_loop, NULL);
 State mode2(&clear_display, &mode2_loop, NULL);
 State mode3(&clear_display, &mode3_loop, NULL);
 State mode4(&mode4_setup, &mode4_loop, &mode4_teardown);
 State mode5(&mode5_setup, &mode5_loop, &mode5_teardown);
 State mode6(&mode6_setup, &mode6_loop, &mode6_teardown);
-State mode_resume_5(&mode_resume_setup, &mode_resume_loop, &mode_resume_teardown);
-State mode_resume_6(&mode_resume_setup, &mode_resume_loop, &mode_resume_teardown);
+State mode_resume_5(&mode_resume_setup, &mode_resume_loop, NULL);
+State mode_resume_6(&mode_resume_setup, &mode_resume_loop, NULL);
 
 
 Fsm mode_fsm(&mode0);
@@ -193,8 +195,8 @@ void setup () {
 
   // Common
   Serial.begin(115200);
-  delay(2000); // wait for serial to connect before starting
-  Serial.println("Starting");
+  // output is buffered (see serial_log.h), so we don't wait for the serial port to connect
+  SERIAL_INFO("Starting");
 
   // SENSOR
 #ifdef ENABLE_SENSOR
@@ -223,43 +225,89 @@ void setup () {
 
 #ifdef ENABLE_SD
   sd.setup();
+  log_setup();
 #endif
 
   config.setup();
   if (config.loadedFromDefault()) {
-    Serial.println("Config File not found, loaded defaults");
+    SERIAL_WARNING("Config File not found, loaded defaults");
     buzzer.failure();
   } else {
-    Serial.println("Config Read Success");
+    SERIAL_INFO("Config Read Success");
     buzzer.success();
   }
 
   setup_fsm();
-  memset(recentRacer, 0, sizeof(recentRacer));
-  memset(recentResult, 0, sizeof(recentResult));
+  clear_recent_results();
 }
 
 uint32_t last_memory_output_time = 0;
 
+// How long each loop() takes, since the last printMemoryPeriodically()
+unsigned long loop_count = 0;
+unsigned long loop_total_micros = 0;
+unsigned long loop_worst_micros = 0;
+
+void countLoopTime(unsigned long loop_micros) {
+  loop_count++;
+  loop_total_micros += loop_micros;
+  if (loop_micros > loop_worst_micros) {
+    loop_worst_micros = loop_micros;
+  }
+}
+
 void printMemoryPeriodically() {
   // if millis() or timer wraps around, we'll just reset it
   if (last_memory_output_time > millis())  last_memory_output_time = millis();
-  // approximately every 2 seconds or so, print out the current GPS stats
+  // approximately every 10 seconds, print out the free memory and loop time
   if (millis() - last_memory_output_time > 10000) {
     last_memory_output_time = millis(); // reset the timer
 
-    Serial.println(F("Memory Free"));
-    Serial.println(freeMemory());
+    SERIAL_INFO("Memory Free: %d loop us avg: %lu worst: %lu serial dropped: %lu",
+      freeMemory(), loop_count > 0 ? loop_total_micros / loop_count : 0, loop_worst_micros,
+      serial_log_dropped());
+    loop_count = 0;
+    loop_total_micros = 0;
+    loop_worst_micros = 0;
   }
 }
 
+uint32_t last_clock_health_log_time = 0;
+
+// Write how well we are keeping time to the log, once a minute
+void logClockHealthPeriodically() {
+  if (millis() - last_clock_health_log_time < 60000UL) {
+    return;
+  }
+  last_clock_health_log_time = millis();
+
+  ClockHealth health;
+  gps.health(&health);
+  char message[140];
+  snprintf(message, sizeof(message), "clock: err=%lu pps_age=%lu drift=%ld miss=%lu extra=%lu unlabelled=%lu csum/min=%u jitter=%u,%u,%u,%u,%u,%u",
+    health.error_micros, health.millis_since_pps, health.drift_ppb,
+    health.missed_pulses, health.extra_pulses, health.unlabelled_pulses,
+    health.checksum_failures_per_minute,
+    health.jitter_histogram[0], health.jitter_histogram[1], health.jitter_histogram[2],
+    health.jitter_histogram[3], health.jitter_histogram[4], health.jitter_histogram[5]);
+  SERIAL_INFO("%s", message);
+  log(LOG_INFO, message);
+}
+
 // MODE Selection FSM
 void loop() {
+  unsigned long loop_start = micros();
   mode_fsm.run_machine();
   
   gps.readData();
+  sd.loop();
+  report_sd_errors();
   checkForModeSelection();
   printMemoryPeriodically();
+  logClockHealthPeriodically();
+  print_diagnostics();
+  serial_log_flush();
+  countLoopTime(micros() - loop_start);
 }
 
 void setup_fsm() {
@@ -272,7 +320,8 @@ void setup_fsm() {
   State *mode_states[] = { &mode2, &mode3, &mode4, &mode_resume_5, &mode_resume_6};
   for (int i = 0; i < 5; i++) {
     mode_fsm.add_transition(&mode1, mode_states[i], MODE_OFFSET + i + 2, NULL);
-    mode_fsm.add_transition(mode_states[i], &mode1, MODE_1, NULL);
+    // leaving Mode Resume for mode 1 (rather than for mode 5/6) ends the race
+    mode_fsm.add_transition(mode_states[i], &mode1, MODE_1, i >= 3 ? &mode_resume_leave : NULL);
   }
   /* Can transition from RESUME_5 to 5 */
   mode_fsm.add_transition(&mode_resume_5, &mode5, MODE_GPS_LOCK, NULL);
@@ -288,76 +337,125 @@ void clear_display() {
 
 
 // Variables
+// _new_mode is the same until a mode is chosen, so that the POST (mode 0) isn't interrupted
 int _mode = 1;
-int _new_mode = -1;
+int _new_mode = 1;
 
 // POST - Check systems, and display Good or Bad on the display
-void mode0_run() {
-  bool success = true;
-
-  buzzer.beep();
-  // Show 88:88
-  display.all();
-  delay(1000);
+// Each step is shown for POST_STEP_MS, without blocking, so that the GPS
+// is read (by loop()) while the checks are shown.
+#define POST_STEP_MS 400
+#define POST_ALL 0
+#define POST_SD 1
+#define POST_SD_RESULT 2
+#define POST_GPS 3
+#define POST_GPS_RESULT 4
+#define POST_RESULT 5
+#define POST_DONE 6
+uint8_t post_step = POST_ALL;
+unsigned long post_step_start = 0;
+bool post_success = true;
+
+// Go to the mode from the config
+// (mode 5/6 is MODE_RESUME_5/6, which waits for GPS lock, as when it is chosen on the keypad)
+void start_configured_mode() {
+  mode_fsm.trigger(MODE_1);
+  mode_fsm.trigger(MODE_OFFSET + config.mode());
+  // simulate user transition to the mode, which is already running
+  _mode = config.mode();
+  _new_mode = _mode;
+  SERIAL_INFO("Resuming %d", _new_mode);
+}
 
+// If the power was lost during a race (we were in mode 5/6, and hadn't left it),
+// skip the display checks, so that the next racer isn't held up
+bool fast_resume() {
+  bool race_in_progress = false;
 #ifdef ENABLE_SD
-  display.sd();
-  delay(1000);
-  if (sd.status()) {
-    Serial.println("SD Card OK");
-    display.good();
-    buzzer.success();
-  } else {
-    Serial.println("SD Card Error");
-    success = false;
-    display.bad();
-    buzzer.failure();
+  if (config.mode() == 5 || config.mode() == 6) {
+    race_in_progress = journal_race_in_progress(config.filename());
   }
-  delay(1000);
 #endif
-
-  // TODO: Check GPS
-  display.gps();
-  delay(1000);
-  if (gps.detected()) {
-    Serial.println("GPS available");
-    display.good();
-    buzzer.success();
-  } else {
-    Serial.println("GPS unavailable");
-    display.bad();
-    buzzer.failure();
+  if (!race_in_progress) {
+    return false;
   }
-  delay(1000);
+  SERIAL_INFO("Race in progress, fast resume");
+  buzzer.beep();
+  start_configured_mode();
+  return true;
+}
 
+void mode0_setup() {
+  if (fast_resume()) {
+    return;
+  }
+  post_success = true;
+  post_step = POST_ALL;
+  post_step_start = millis();
+  buzzer.beep();
+  // Show 88:88
   display.all();
-  delay(1000);
-  if (success) {
-    Serial.println("All systems Good");
-    display.good();
-    delay(1000);
-    int target_mode = MODE_OFFSET + config.mode();
-    if (target_mode == MODE_5) {
-      mode_fsm.trigger(MODE_1);
-      mode_fsm.trigger(MODE_RESUME_5);
-      _new_mode = MODE_RESUME_5 - MODE_OFFSET; // simulate user transition to Mode Resume
-    } else if (target_mode == MODE_6) {
-      mode_fsm.trigger(MODE_1);
-      mode_fsm.trigger(MODE_RESUME_6);
-      _new_mode = MODE_RESUME_6 - MODE_OFFSET; // simulate user transition to Mode Resume
-    } else {
-      mode_fsm.trigger(MODE_1);
-      mode_fsm.trigger(target_mode);
-      _new_mode = config.mode();
-    }
-    Serial.println("Resuming");
-    Serial.println(_new_mode);
-  } else {
-    Serial.println("*************** Init Problem");
-    display.bad();
-    delay(1000);
-    mode_fsm.trigger(MODE_1);
-    _new_mode = 1; // simulate user transition to Mode 1
+}
+
+void mode0_loop() {
+  if (millis() - post_step_start < POST_STEP_MS) {
+    return;
+  }
+  post_step_start = millis();
+  post_step++;
+
+  switch (post_step) {
+    case POST_SD:
+#ifdef ENABLE_SD
+      display.sd();
+#endif
+      break;
+    case POST_SD_RESULT:
+#ifdef ENABLE_SD
+      if (sd.status()) {
+        SERIAL_INFO("SD Card OK");
+        display.good();
+        buzzer.success();
+      } else {
+        SERIAL_ERROR("SD Card Error");
+        post_success = false;
+        display.bad();
+        buzzer.failure();
+      }
+#endif
+      break;
+    case POST_GPS:
+      display.gps();
+      break;
+    case POST_GPS_RESULT:
+      if (gps.detected()) {
+        SERIAL_INFO("GPS available");
+        display.good();
+        buzzer.success();
+      } else {
+        SERIAL_WARNING("GPS unavailable");
+        display.bad();
+        buzzer.failure();
+      }
+      break;
+    case POST_RESULT:
+      if (post_success) {
+        SERIAL_INFO("All systems Good");
+        display.good();
+      } else {
+        SERIAL_ERROR("*************** Init Problem");
+        display.bad();
+      }
+      break;
+    case POST_DONE:
+      if (post_success) {
+        start_configured_mode();
+      } else {
+        mode_fsm.trigger(MODE_1);
+        _mode = 1;
+        _new_mode = 1; // simulate user transition to Mode 1
+      }
+      break;
   }
 }
 
@@ -365,12 +463,14 @@ void mode0_run() {
 
 // ------------------------------------------
 
+// Page of results shown by 0 + 1..9
+unsigned long history_page = 0;
+
 // Check to see if a new mode is selected
 void checkForModeSelection() {
   // Only switch to the new mode after all keys are pressed
   if (_new_mode != _mode && !modeKeypad.anyKeyPressed()) {
-    Serial.print("new mode: ");
-    Serial.println(_new_mode);
+    SERIAL_INFO("new mode: %d", _new_mode);
     config.setMode(_new_mode);
     mode_fsm.trigger(MODE_1); // go to mode 1 before any other mode
     mode_fsm.trigger(MODE_OFFSET + _new_mode); // trigger MODE_1, MODE_2, etc
@@ -378,11 +478,11 @@ void checkForModeSelection() {
   }
   
   if (modeKeypad.newKeyPressed()) {
-    Serial.println("NEW KEY");
+    SERIAL_DEBUG("NEW KEY");
     // Detect star AND number 1-6 pressed at same time
     // Switches mode
     if (modeKeypad.keyPressed('*')) {
-      Serial.println("* is pressed");
+      SERIAL_DEBUG("* is pressed");
       if (modeKeypad.keyPressed('1')) _new_mode = 1;
       if (modeKeypad.keyPressed('2')) _new_mode = 2;
       if (modeKeypad.keyPressed('3')) _new_mode = 3;
@@ -392,15 +492,16 @@ void checkForModeSelection() {
     }
 
     // Detect 0 and number 1-9 pressed at same time
-    // displays recent results
+    // displays recent results (0 and # goes back a page, to older results)
     if (modeKeypad.keyPressed('0')) {
-      TimeResult *data;
+      TimeResult data;
+      int racer;
       int index = -1;
       // display the ssmm (2 seconds, and 2 digits of milliseconds)
       // display.showNumber((data.second * 100) + (data.millisecond /10));
       // display the milliseconds
 
-      Serial.println("0 is pressed");
+      SERIAL_DEBUG("0 is pressed");
       if (modeKeypad.keyPressed('1')) index = 0;
       if (modeKeypad.keyPressed('2')) index = 1;
       if (modeKeypad.keyPressed('3')) index = 2;
@@ -411,13 +512,22 @@ void checkForModeSelection() {
       if (modeKeypad.keyPressed('8')) index = 7;
       if (modeKeypad.keyPressed('9')) index = 8;
 
-      if (index != -1) {
-        data = &recentResult[index];
-        display.showNumber(data->minute);
+      if (modeKeypad.keyPressed('#')) {
+        // wraps around to the newest results, after the oldest
+        history_page++;
+        if (history_page * HISTORY_PAGE_SIZE >= race_history_count()) {
+          history_page = 0;
+        }
+        display.showNumber(history_page + 1);
+        delay(500);
+      }
+
+      if (index != -1 && race_history(history_page * HISTORY_PAGE_SIZE + index, &racer, &data)) {
+        display.showNumber(data.minute);
         delay(500);
-        display.showNumber(data->second);
+        display.showNumber(data.second);
         delay(500);
-        display.showNumber(data->millisecond);
+        display.showNumber(data.millisecond);
         delay(500);
       }
     }
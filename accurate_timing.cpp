@@ -1,10 +1,17 @@
 #include "accurate_timing.h"
+#include "crossing_queue.h"
+#include "crossing_filter.h"
+#include "diagnostics.h"
 
-unsigned long _interrupt_millis; // this value is cleared once the sensor trip is handled.
-unsigned long _last_interrupt_millis; // this value is not cleared after the sensor trip is handled
+// only written by the sensor interrupt
+volatile unsigned long _block_start_micros;
+TimeResult _block_start_time;
+volatile bool _sensor_blocked = false; // set by the sensor interrupt
 
-// LAST SENSOR DATE/TIME
-TimeResult last_sensor_time;
+// BLOCKED INTERVALS, from the sensor interrupt
+CrossingQueue crossings;
+// RACER CROSSINGS, made from those intervals, waiting to be handled by the main loop
+CrossingFilter crossing_filter;
 
 // Method which we can use in order to get the current year/date/time.
 
@@ -16,49 +23,100 @@ extern UniGps gps;
 // so that when the sensor interrupt is fired,
 // we can determine the current time accurately.
 // NOTE: The GPS PPS signal will ONLY fire when there is GPS lock.
-void pps_interrupt() {
-  unsigned long now = millis();
-
-  gps.synchronizeClocks(now);
+// micros() is used so that crossings can be split below 1 millisecond.
+// `now` is the micros() at which the edge happened (see input_capture.h)
+void pps_interrupt(unsigned long now) {
+  unsigned long entry = micros();
+  gps.ppsReceived(now);
+  diag_isr_duration(DIAG_ISR_PPS, entry);
 }
 
 #include "uni_config.h"
 extern UniConfig config;
 
-void sensor_interrupt() {
-  unsigned long now = millis();
-  // Don't trigger 2x in 0.5 seconds (by default 500ms)
-  unsigned long required_spacing = config.get_finish_line_spacing();
-  if (now - _last_interrupt_millis < required_spacing) {
-    Serial.println("Ignoring as too close to previous crossing");
-    return;
+#include "uni_sensor.h"
+extern UniSensor sensor;
+
+// Called on both edges of the sensor.
+// The time of a crossing is when the sensor becomes blocked,
+// but it is only queued once the sensor is clear again, so that the main loop
+// can tell noise from a racer by how long it was blocked (see crossing_filter.h)
+void sensor_interrupt(unsigned long now) {
+  unsigned long entry = micros();
+  if (sensor.blocked()) {
+    if (!_sensor_blocked) {
+      _block_start_micros = now;
+      gps.current_time(&_block_start_time, now);
+      _block_start_time.error_micros += sensor.capture_latency();
+      _sensor_blocked = true;
+    }
+    // else: we missed a very short clear interval, keep the original start
+  } else if (_sensor_blocked) {
+    _sensor_blocked = false;
+    CrossingEvent interval;
+    interval.micros = _block_start_micros;
+    interval.blocked_micros = now - _block_start_micros;
+    interval.blocks = 1;
+    interval.kind = CROSSING_UNKNOWN;
+    interval.time = _block_start_time;
+    if (!crossings.push(&interval)) {
+      diag_record(DIAG_SENSOR_QUEUE_FULL, _block_start_micros);
+    }
+  } else {
+    // both edges happened before we could read the sensor, this is noise
+    diag_record(DIAG_SENSOR_MISSED_EDGE, now);
   }
-  _interrupt_millis = now;
-  _last_interrupt_millis = now;
-  gps.current_time(&last_sensor_time, now);
+  diag_isr_duration(DIAG_ISR_SENSOR, entry);
+}
+
+// Pass the blocked intervals from the interrupt through the crossing filter
+void update_crossings() {
+  crossing_filter.setMergeGap(config.get_finish_line_spacing() * 1000UL);
+  CrossingEvent interval;
+  unsigned long now;
+  bool blocked;
+  unsigned long blocked_since;
+  do {
+    while (crossings.pop(&interval)) {
+      crossing_filter.add(&interval);
+    }
+    now = micros();
+    blocked = _sensor_blocked;
+    blocked_since = _block_start_micros;
+    // if an interval finished while we read the sensor, it must be merged first
+  } while (!crossings.empty());
+  crossing_filter.flush(now, blocked, blocked_since);
 }
 
 bool sensor_has_triggered() {
-  return _interrupt_millis != 0;
+  update_crossings();
+  return crossing_filter.available();
 }
 
-unsigned long sensor_interrupt_millis() {
-  return _interrupt_millis;
+// Remove the oldest sensor crossing
+// return false if there are none
+bool nextSensorTime(TimeResult *output) {
+  update_crossings();
+  CrossingEvent crossing;
+  if (!crossing_filter.next(&crossing)) {
+    return false;
+  }
+  *output = crossing.time;
+  return true;
 }
 
-void clear_sensor_interrupt_millis() {
-  _interrupt_millis = 0;
+// Drop any sensor crossings which have not been handled
+void clear_sensor_crossings() {
+  crossings.clear();
+  crossing_filter.clear();
 }
 
-bool lastSensorTime(TimeResult *output) {
-  output->hour = last_sensor_time.hour;
-  output->minute = last_sensor_time.minute;
-  output->second = last_sensor_time.second;
-  output->millisecond = last_sensor_time.millisecond;
-  return true;
+// Number of sensor crossings lost because the main loop didn't handle them quickly enough
+unsigned long sensor_crossings_dropped() {
+  return crossings.overflows();
 }
 
 bool currentTime(TimeResult *output) {
-  gps.current_time(output, millis());
+  gps.current_time(output, micros());
   return true;
 }
@@ -3,10 +3,10 @@
 #include <Arduino.h>
 #include "uni_gps.h"
 
-void pps_interrupt();
-void sensor_interrupt();
+void pps_interrupt(unsigned long now);
+void sensor_interrupt(unsigned long now);
 bool sensor_has_triggered();
-bool lastSensorTime(TimeResult *output);
+bool nextSensorTime(TimeResult *output);
 bool currentTime(TimeResult *output);
-unsigned long sensor_interrupt_millis();
-void clear_sensor_interrupt_millis();
+void clear_sensor_crossings();
+unsigned long sensor_crossings_dropped();
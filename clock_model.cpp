@@ -0,0 +1,167 @@
+// PPS-disciplined model of the local clock
+#include "clock_model.h"
+
+ClockModel::ClockModel()
+{
+  _rejected_pulses = 0;
+  _missed_pulses = 0;
+  memset(_jitter_histogram, 0, sizeof(_jitter_histogram));
+  reset();
+}
+
+// Forget everything we have learned about the local oscillator
+void ClockModel::reset() {
+  _count = 0;
+  _newest = 0;
+  _seconds = 0;
+  _drift_ppb = 0;
+  _uncertainty_ppb = CLOCK_MODEL_UNCALIBRATED_PPB;
+  _calibrated = false;
+  _jitter_micros = 0;
+  _consecutive_rejections = 0;
+  _drift_factor = 0;
+  _uncertainty_factor = (int32_t)(((int64_t)CLOCK_MODEL_UNCALIBRATED_PPB << 32) / 1000000000LL);
+}
+
+// Add a PPS edge, captured at local_micros.
+// return true if the edge was accepted
+// return false if the edge did not line up with the previous edges (noise, or an extra pulse)
+bool ClockModel::addPulse(unsigned long local_micros) {
+  if (_count == 0) {
+    // first edge of a new window
+    _newest = 0;
+    _seconds = 0;
+    _edge_micros[0] = local_micros;
+    _edge_seconds[0] = 0;
+    _edge_residual[0] = 0;
+    _count = 1;
+    return true;
+  }
+
+  unsigned long interval = local_micros - _edge_micros[_newest];
+  if (interval > CLOCK_MODEL_MAX_GAP_SECONDS * 1000000UL) {
+    // Too long since the last edge to count the seconds reliably,
+    // start a new window, but keep the calibration that we have
+    _count = 0;
+    return addPulse(local_micros);
+  }
+
+  // how long a second is, in local micros
+  unsigned long expected_second = 1000000 + (_drift_ppb / 1000);
+  unsigned long seconds = (interval + (expected_second / 2)) / expected_second;
+  long residual = (long)(interval - (seconds * expected_second));
+  if (seconds == 0 || (_calibrated && abs(residual) > CLOCK_MODEL_MAX_RESIDUAL_MICROS)) {
+    _rejected_pulses++;
+    _consecutive_rejections++;
+    if (_consecutive_rejections >= 3) {
+      // our model no longer matches the PPS, start over
+      reset();
+    }
+    return false;
+  }
+  _consecutive_rejections = 0;
+  _missed_pulses += seconds - 1;
+  countJitter(abs(residual));
+
+  _newest = (_newest + 1) % CLOCK_MODEL_WINDOW;
+  _seconds += seconds;
+  _edge_micros[_newest] = local_micros;
+  _edge_seconds[_newest] = _seconds;
+  _edge_residual[_newest] = residual;
+  if (_count < CLOCK_MODEL_WINDOW) {
+    _count++;
+  }
+  estimate();
+  return true;
+}
+
+// Have we seen enough PPS edges to trust the drift estimate
+bool ClockModel::calibrated() {
+  return _calibrated;
+}
+
+// How fast the local clock runs, in parts-per-billion.
+// positive means that micros() runs fast
+long ClockModel::driftPpb() {
+  return _drift_ppb;
+}
+
+// Largest difference between where we expected a PPS edge, and where it was
+unsigned long ClockModel::jitterMicros() {
+  return _jitter_micros;
+}
+
+unsigned long ClockModel::rejectedPulses() {
+  return _rejected_pulses;
+}
+
+// drift, as a fixed point (2^-32) fraction, see clock_correct()
+int32_t ClockModel::driftFactor() {
+  return _drift_factor;
+}
+
+// drift uncertainty, as a fixed point (2^-32) fraction, see clock_error_bound()
+int32_t ClockModel::uncertaintyFactor() {
+  return _uncertainty_factor;
+}
+
+// Number of PPS pulses which we expected, but didn't get
+unsigned long ClockModel::missedPulses() {
+  return _missed_pulses;
+}
+
+// Counts of accepted PPS intervals, by how far they were from where we expected
+// (see CLOCK_MODEL_HISTOGRAM_BUCKETS)
+const uint16_t *ClockModel::jitterHistogram() {
+  return _jitter_histogram;
+}
+
+/* ******************* PRIVATE METHODS ******************* */
+void ClockModel::countJitter(unsigned long residual_micros) {
+  uint8_t bucket = 0;
+  unsigned long limit = 2;
+  while (bucket < CLOCK_MODEL_HISTOGRAM_BUCKETS - 1 && residual_micros >= limit) {
+    bucket++;
+    limit *= 4;
+  }
+  if (_jitter_histogram[bucket] < 0xFFFF) {
+    _jitter_histogram[bucket]++;
+  }
+}
+
+// Re-estimate the drift and uncertainty from the edges in the window
+void ClockModel::estimate() {
+  if (_count < 2) {
+    return;
+  }
+  if (_calibrated && _count < 4) {
+    // a new window after a gap, keep the previous estimate until this one is as good
+    return;
+  }
+  uint8_t oldest = (_newest + CLOCK_MODEL_WINDOW - (_count - 1)) % CLOCK_MODEL_WINDOW;
+  unsigned long span_seconds = _edge_seconds[_newest] - _edge_seconds[oldest];
+  unsigned long span_micros = _edge_micros[_newest] - _edge_micros[oldest];
+  long error_micros = (long)(span_micros - (span_seconds * 1000000UL));
+  _drift_ppb = (error_micros * 1000L) / (long)span_seconds;
+
+  _jitter_micros = 0;
+  for (uint8_t i = 0; i < _count; i++) {
+    uint8_t index = (oldest + i) % CLOCK_MODEL_WINDOW;
+    unsigned long residual = abs(_edge_residual[index]);
+    if (residual > _jitter_micros) {
+      _jitter_micros = residual;
+    }
+  }
+
+  // the drift can be wrong by the jitter at both ends of the window
+  _uncertainty_ppb = CLOCK_MODEL_MIN_UNCERTAINTY_PPB + ((2 * _jitter_micros * 1000L) / (long)span_seconds);
+  if (_count >= 4) {
+    _calibrated = true;
+  }
+  if (!_calibrated && _uncertainty_ppb < CLOCK_MODEL_UNCALIBRATED_PPB) {
+    _uncertainty_ppb = CLOCK_MODEL_UNCALIBRATED_PPB;
+  }
+
+  _drift_factor = (int32_t)(((int64_t)_drift_ppb << 32) / 1000000000LL);
+  _uncertainty_factor = (int32_t)(((int64_t)_uncertainty_ppb << 32) / 1000000000LL);
+}
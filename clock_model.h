@@ -0,0 +1,60 @@
+#ifndef CLOCK_MODEL_H
+#define CLOCK_MODEL_H
+#include <Arduino.h>
+
+// Number of PPS edges used to estimate the crystal frequency error
+#define CLOCK_MODEL_WINDOW 16
+// A PPS edge which is further than this from where we expected it is rejected
+#define CLOCK_MODEL_MAX_RESIDUAL_MICROS 500
+// Assumed crystal frequency error before we have measured it (100ppm)
+#define CLOCK_MODEL_UNCALIBRATED_PPB 100000
+// Frequency uncertainty which we always add (temperature changes, aging)
+#define CLOCK_MODEL_MIN_UNCERTAINTY_PPB 50
+// If the PPS is missing for longer than this, start a new window
+#define CLOCK_MODEL_MAX_GAP_SECONDS 60
+// PPS interval errors are counted in buckets: <2us, <8us, <32us, <128us, <512us, more
+#define CLOCK_MODEL_HISTOGRAM_BUCKETS 6
+
+// Models the local oscillator (micros()) against the GPS PPS signal.
+//
+// Each accepted PPS edge is stored in a sliding window, which is used to
+// estimate how fast micros() runs compared to true time (drift).
+// Elapsed local time since the last PPS edge is corrected by that drift,
+// so that we keep accurate time when the GPS lock is lost (holdover).
+class ClockModel
+{
+  public:
+    ClockModel();
+    void reset();
+    bool addPulse(unsigned long local_micros);
+    bool calibrated();
+    long driftPpb();
+    unsigned long jitterMicros();
+    unsigned long rejectedPulses();
+    int32_t driftFactor();
+    int32_t uncertaintyFactor();
+    unsigned long missedPulses();
+    const uint16_t *jitterHistogram();
+  private:
+    unsigned long _edge_micros[CLOCK_MODEL_WINDOW];
+    unsigned long _edge_seconds[CLOCK_MODEL_WINDOW];
+    long _edge_residual[CLOCK_MODEL_WINDOW];
+    uint8_t _count;
+    uint8_t _newest;
+    unsigned long _seconds;
+    long _drift_ppb;
+    long _uncertainty_ppb;
+    bool _calibrated;
+    unsigned long _jitter_micros;
+    unsigned long _rejected_pulses;
+    uint8_t _consecutive_rejections;
+    unsigned long _missed_pulses;
+    uint16_t _jitter_histogram[CLOCK_MODEL_HISTOGRAM_BUCKETS];
+    // fixed point (2^-32) factors, so that clock_correct() doesn't need a division
+    int32_t _drift_factor;
+    int32_t _uncertainty_factor;
+    void estimate();
+    void countJitter(unsigned long residual_micros);
+};
+
+#endif
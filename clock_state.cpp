@@ -0,0 +1,48 @@
+// Tear-free sharing of the clock state between the main loop and interrupts
+#include "clock_state.h"
+
+// Order memory accesses across this point, for the compiler and the CPU
+// (a dmb on ARM, which the Teensy LC's single core doesn't need, but which is cheap)
+#define MEMORY_BARRIER() __sync_synchronize()
+
+// Convert an elapsed time since the last PPS edge, measured in local micros,
+// into true micros
+uint64_t clock_correct(const ClockState *state, uint64_t local_elapsed_micros) {
+  int64_t correction = ((int64_t)local_elapsed_micros * state->drift_factor) >> 32;
+  return local_elapsed_micros - correction;
+}
+
+// How far (in micros) can the corrected time be from the true time,
+// after local_elapsed_micros since the last PPS edge
+unsigned long clock_error_bound(const ClockState *state, uint64_t local_elapsed_micros) {
+  uint64_t drift_error = ((uint64_t)local_elapsed_micros * (uint32_t)state->uncertainty_factor) >> 32;
+  return state->jitter_micros + (unsigned long)drift_error + 1;
+}
+
+ClockStateBuffer::ClockStateBuffer()
+{
+  memset(_buffers, 0, sizeof(_buffers));
+  _generation = 0;
+}
+
+// Only one writer at a time
+void ClockStateBuffer::write(const ClockState *state) {
+  _generation = _generation + 1; // odd: readers use _buffers[1]
+  MEMORY_BARRIER();
+  _buffers[0] = *state;
+  MEMORY_BARRIER();
+  _generation = _generation + 1; // even: readers use _buffers[0]
+  MEMORY_BARRIER();
+  _buffers[1] = *state;
+  MEMORY_BARRIER();
+}
+
+void ClockStateBuffer::read(ClockState *state) {
+  unsigned long generation;
+  do {
+    generation = _generation;
+    MEMORY_BARRIER();
+    *state = _buffers[generation & 1];
+    MEMORY_BARRIER();
+  } while (generation != _generation);
+}
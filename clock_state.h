@@ -0,0 +1,41 @@
+#ifndef CLOCK_STATE_H
+#define CLOCK_STATE_H
+#include <Arduino.h>
+
+// Everything needed to turn a micros() into a time of day.
+// Written by the main loop after each PPS pulse, read by the sensor interrupt and the main loop.
+typedef struct {
+  bool valid; // have we had a PPS pulse yet
+  unsigned long pps_micros; // micros() of the last PPS pulse
+  unsigned long pps_millis; // millis() of the last PPS pulse, used to count micros() wrap-arounds
+  unsigned long gps_epoch_seconds; // GPS time of the last PPS pulse, seconds since the epoch
+  // From the ClockModel, see clock_model.h
+  int32_t drift_factor;
+  int32_t uncertainty_factor;
+  unsigned long jitter_micros;
+} ClockState;
+
+uint64_t clock_correct(const ClockState *state, uint64_t local_elapsed_micros);
+unsigned long clock_error_bound(const ClockState *state, uint64_t local_elapsed_micros);
+
+// Double-buffered ClockState, with a sequence count (a seqlock which readers never wait on).
+//
+// The generation is odd while _buffers[0] is written, and even while _buffers[1] is written,
+// and readers read the other buffer (generation & 1), so a reader never sees a half-written
+// state, and never has to disable interrupts. A reader which overlaps a write (on another core,
+// or interrupted by the writer) notices that the generation changed, and reads again.
+//
+// A plain seqlock would make an interrupt spin forever if it interrupted the writer,
+// which is why there are two buffers.
+class ClockStateBuffer
+{
+  public:
+    ClockStateBuffer();
+    void write(const ClockState *state);
+    void read(ClockState *state);
+  private:
+    ClockState _buffers[2];
+    volatile unsigned long _generation;
+};
+
+#endif
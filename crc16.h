@@ -0,0 +1,19 @@
+#ifndef CRC16_H
+#define CRC16_H
+#include <stdint.h>
+
+// CRC-16/CCITT, used by the journal, the binary result records and the config.
+// Header-only, so that the host tools (see tools/) can use it too.
+// Pass the previous result as crc to continue a CRC over several pieces.
+static inline uint16_t crc16_ccitt(const void *data, int length, uint16_t crc = 0xFFFF) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (int i = 0; i < length; i++) {
+    crc ^= (uint16_t)bytes[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+#endif
@@ -0,0 +1,95 @@
+// Classifies the sensor's blocked intervals into racer crossings
+#include "crossing_filter.h"
+#include "serial_log.h"
+
+// Classify a blocked interval, or a crossing made of `blocks` intervals, by its shape
+uint8_t crossing_kind(unsigned long blocked_micros, uint8_t blocks) {
+  if (blocked_micros < CROSSING_GLITCH_MICROS) {
+    return CROSSING_GLITCH;
+  }
+  if (blocks == 1 && blocked_micros < CROSSING_WHEEL_MAX_MICROS) {
+    return CROSSING_WHEEL;
+  }
+  return CROSSING_BODY;
+}
+
+CrossingFilter::CrossingFilter()
+{
+  _has_pending = false;
+  _merge_gap_micros = 0;
+  _glitches = 0;
+}
+
+void CrossingFilter::setMergeGap(unsigned long merge_gap_micros) {
+  _merge_gap_micros = merge_gap_micros;
+}
+
+// Add a blocked interval (micros, blocked_micros) from the sensor interrupt
+void CrossingFilter::add(const CrossingEvent *interval) {
+  if (crossing_kind(interval->blocked_micros, 1) == CROSSING_GLITCH) {
+    _glitches++;
+    return;
+  }
+
+  if (_has_pending) {
+    unsigned long pending_end = _pending.micros + _pending.blocked_micros;
+    if (interval->micros - pending_end < _merge_gap_micros) {
+      // same racer, extend the crossing
+      _pending.blocked_micros = (interval->micros + interval->blocked_micros) - _pending.micros;
+      _pending.blocks++;
+      return;
+    }
+    finish();
+  }
+
+  _pending = *interval;
+  _pending.blocks = 1;
+  _has_pending = true;
+}
+
+// The racer has passed once the sensor has been clear for the merge gap,
+// even if the next racer is blocking it now (since `blocked_since`)
+// All the intervals which finished before now must have been added.
+void CrossingFilter::flush(unsigned long now_micros, bool blocked, unsigned long blocked_since) {
+  if (!_has_pending) {
+    return;
+  }
+  unsigned long pending_end = _pending.micros + _pending.blocked_micros;
+  unsigned long clear_until = blocked ? blocked_since : now_micros;
+  if (clear_until - pending_end >= _merge_gap_micros) {
+    finish();
+  }
+}
+
+// Remove the oldest crossing
+// return false if there are none
+bool CrossingFilter::next(CrossingEvent *crossing) {
+  return _ready.pop(crossing);
+}
+
+bool CrossingFilter::available() {
+  return !_ready.empty();
+}
+
+// Drop the crossings which have not been handled, including one in progress
+void CrossingFilter::clear() {
+  _has_pending = false;
+  _ready.clear();
+}
+
+// Number of blocked intervals dropped as electrical noise
+unsigned long CrossingFilter::glitches() {
+  return _glitches;
+}
+
+/* ******************* PRIVATE METHODS ******************* */
+void CrossingFilter::finish() {
+  _pending.kind = crossing_kind(_pending.blocked_micros, _pending.blocks);
+  SERIAL_INFO("Crossing (%s) blocked us: %lu intervals: %u glitches: %lu",
+    _pending.kind == CROSSING_WHEEL ? "wheel" : "body", _pending.blocked_micros, _pending.blocks, _glitches);
+
+  if (!_ready.push(&_pending)) {
+    SERIAL_WARNING("Crossing dropped, too many waiting");
+  }
+  _has_pending = false;
+}
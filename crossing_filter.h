@@ -0,0 +1,45 @@
+#ifndef CROSSING_FILTER_H
+#define CROSSING_FILTER_H
+#include <Arduino.h>
+#include "crossing_queue.h"
+
+// Blocked for less than this is electrical noise, not a racer
+#define CROSSING_GLITCH_MICROS 2000UL
+// A single blocked interval shorter than this is only a wheel (the tyre)
+#define CROSSING_WHEEL_MAX_MICROS 80000UL
+
+#define CROSSING_UNKNOWN 0
+#define CROSSING_GLITCH 1 // shorter than CROSSING_GLITCH_MICROS, dropped
+#define CROSSING_WHEEL 2 // one short blocked interval
+#define CROSSING_BODY 3 // a longer interval, or several intervals close together (wheel, legs, body)
+
+uint8_t crossing_kind(unsigned long blocked_micros, uint8_t blocks);
+
+// Turns the blocked intervals measured by the sensor interrupt into racer crossings.
+//
+// Intervals shorter than CROSSING_GLITCH_MICROS are dropped.
+// Intervals which start less than `merge gap` after the previous one ended
+// are the same racer (e.g. wheel, then legs), and are merged into one crossing,
+// timed at the start of the first interval, and classified as a wheel or a body.
+// Called only from the main loop.
+class CrossingFilter
+{
+  public:
+    CrossingFilter();
+    void setMergeGap(unsigned long merge_gap_micros);
+    void add(const CrossingEvent *interval);
+    void flush(unsigned long now_micros, bool blocked, unsigned long blocked_since);
+    bool next(CrossingEvent *crossing);
+    bool available();
+    void clear();
+    unsigned long glitches();
+  private:
+    CrossingEvent _pending;
+    bool _has_pending;
+    unsigned long _merge_gap_micros;
+    unsigned long _glitches;
+    CrossingQueue _ready;
+    void finish();
+};
+
+#endif
@@ -0,0 +1,57 @@
+// Queue of sensor crossings, from the sensor interrupt to the main loop
+#include "crossing_queue.h"
+
+CrossingQueue::CrossingQueue()
+{
+  _head = 0;
+  _tail = 0;
+  _overflows = 0;
+}
+
+// Called from the interrupt
+// return false if the queue is full, and the event was dropped
+bool CrossingQueue::push(const CrossingEvent *event) {
+  uint8_t head = _head;
+  if ((uint8_t)(head - _tail) >= CROSSING_QUEUE_SIZE) {
+    _overflows = _overflows + 1;
+    return false;
+  }
+  _events[head & (CROSSING_QUEUE_SIZE - 1)] = *event;
+  // the event must be complete before the consumer can see it
+  COMPILER_BARRIER();
+  _head = head + 1;
+  return true;
+}
+
+// Called from the main loop
+// return the oldest event, or false if there are none
+bool CrossingQueue::pop(CrossingEvent *event) {
+  uint8_t tail = _tail;
+  if (tail == _head) {
+    return false;
+  }
+  COMPILER_BARRIER();
+  *event = _events[tail & (CROSSING_QUEUE_SIZE - 1)];
+  // we must be done reading the event before the producer can re-use the slot
+  COMPILER_BARRIER();
+  _tail = tail + 1;
+  return true;
+}
+
+bool CrossingQueue::empty() {
+  return _tail == _head;
+}
+
+uint8_t CrossingQueue::count() {
+  return (uint8_t)(_head - _tail);
+}
+
+// Called from the main loop, drops all of the events
+void CrossingQueue::clear() {
+  _tail = _head;
+}
+
+// Number of events dropped because the queue was full
+unsigned long CrossingQueue::overflows() {
+  return _overflows;
+}
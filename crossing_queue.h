@@ -0,0 +1,41 @@
+#ifndef CROSSING_QUEUE_H
+#define CROSSING_QUEUE_H
+#include <Arduino.h>
+#include "uni_gps.h"
+
+// Must be a power of 2
+#define CROSSING_QUEUE_SIZE 16
+
+// Prevent the compiler from moving memory accesses across this point
+#define COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+typedef struct {
+  unsigned long micros; // micros() when the sensor was first blocked
+  unsigned long blocked_micros; // how long the sensor was blocked
+  uint8_t blocks; // how many blocked intervals make up this crossing
+  uint8_t kind; // CROSSING_WHEEL, CROSSING_BODY (see crossing_filter.h)
+  TimeResult time; // time of `micros`
+} CrossingEvent;
+
+// Single-producer/single-consumer queue of sensor crossings (or blocked intervals).
+// The sensor interrupt is the only producer (push),
+// the main loop is the only consumer (pop/clear),
+// so no interrupts need to be disabled to use it.
+class CrossingQueue
+{
+  public:
+    CrossingQueue();
+    bool push(const CrossingEvent *event);
+    bool pop(CrossingEvent *event);
+    bool empty();
+    uint8_t count();
+    void clear();
+    unsigned long overflows();
+  private:
+    CrossingEvent _events[CROSSING_QUEUE_SIZE];
+    volatile uint8_t _head; // only written by the producer
+    volatile uint8_t _tail; // only written by the consumer
+    volatile unsigned long _overflows;
+};
+
+#endif
@@ -0,0 +1,85 @@
+// Deferred diagnostics, recorded by interrupts and printed by the main loop
+#include "diagnostics.h"
+#include "crossing_queue.h" // COMPILER_BARRIER
+#include "serial_log.h"
+
+DiagnosticEvent diag_events[DIAGNOSTICS_SIZE];
+volatile uint8_t diag_head = 0; // only written by the interrupts
+volatile uint8_t diag_tail = 0; // only written by the main loop
+volatile unsigned long diag_dropped = 0;
+
+volatile unsigned long diag_worst_isr[DIAG_ISR_COUNT];
+unsigned long diag_reported_isr[DIAG_ISR_COUNT];
+unsigned long diag_reported_dropped = 0;
+
+// Record an event, if there is room for it
+void diag_record(uint8_t code, unsigned long value) {
+  uint8_t head = diag_head;
+  if ((uint8_t)(head - diag_tail) >= DIAGNOSTICS_SIZE) {
+    diag_dropped = diag_dropped + 1;
+    return;
+  }
+  diag_events[head & (DIAGNOSTICS_SIZE - 1)].code = code;
+  diag_events[head & (DIAGNOSTICS_SIZE - 1)].value = value;
+  COMPILER_BARRIER();
+  diag_head = head + 1;
+}
+
+// Call at the end of an interrupt, with the micros() from the start of it
+void diag_isr_duration(uint8_t isr, unsigned long entry_micros) {
+  unsigned long duration = micros() - entry_micros;
+  if (duration > diag_worst_isr[isr]) {
+    diag_worst_isr[isr] = duration;
+  }
+}
+
+unsigned long diag_worst_isr_micros(uint8_t isr) {
+  return diag_worst_isr[isr];
+}
+
+unsigned long diag_events_dropped() {
+  return diag_dropped;
+}
+
+void print_diagnostic_event(DiagnosticEvent *event) {
+  switch(event->code) {
+    case DIAG_SENSOR_MISSED_EDGE:
+      SERIAL_WARNING("Sensor glitch, missed an edge at: %lu", event->value);
+      break;
+    case DIAG_SENSOR_QUEUE_FULL:
+      SERIAL_WARNING("Sensor queue full, dropped crossing at: %lu", event->value);
+      break;
+    case DIAG_PPS_OVERRUN:
+      SERIAL_WARNING("PPS not processed in time: %lu", event->value);
+      break;
+    default:
+      SERIAL_WARNING("Unknown diagnostic %u: %lu", event->code, event->value);
+      break;
+  }
+}
+
+// Print any events recorded by interrupts since the last call,
+// and any new worst-case interrupt durations
+void print_diagnostics() {
+  while (diag_tail != diag_head) {
+    uint8_t tail = diag_tail;
+    COMPILER_BARRIER();
+    DiagnosticEvent event = diag_events[tail & (DIAGNOSTICS_SIZE - 1)];
+    COMPILER_BARRIER();
+    diag_tail = tail + 1;
+    print_diagnostic_event(&event);
+  }
+
+  if (diag_dropped != diag_reported_dropped) {
+    diag_reported_dropped = diag_dropped;
+    SERIAL_WARNING("Diagnostics dropped: %lu", diag_reported_dropped);
+  }
+
+  for (int i = 0; i < DIAG_ISR_COUNT; i++) {
+    unsigned long worst = diag_worst_isr[i];
+    if (worst != diag_reported_isr[i]) {
+      diag_reported_isr[i] = worst;
+      SERIAL_INFO("Worst %s ISR (us): %lu", i == DIAG_ISR_SENSOR ? "sensor" : "PPS", worst);
+    }
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+#include <Arduino.h>
+
+// Interrupts must not print to Serial (it is slow, and may block).
+// Instead, they record a compact event code here,
+// and the main loop prints them later (print_diagnostics).
+//
+// NOTE: All producers (the sensor and PPS interrupts) must run at the same
+// interrupt priority, so that they can't interrupt each other.
+
+// Must be a power of 2
+#define DIAGNOSTICS_SIZE 16
+
+#define DIAG_SENSOR_MISSED_EDGE 1 // value: micros of the edge
+#define DIAG_SENSOR_QUEUE_FULL 2 // value: micros of the dropped crossing
+#define DIAG_PPS_OVERRUN 3 // value: micros of the pulse which was not processed in time
+
+// Interrupts whose worst-case duration is measured
+#define DIAG_ISR_SENSOR 0
+#define DIAG_ISR_PPS 1
+#define DIAG_ISR_COUNT 2
+
+typedef struct {
+  uint8_t code;
+  unsigned long value;
+} DiagnosticEvent;
+
+// Called from interrupts
+void diag_record(uint8_t code, unsigned long value);
+void diag_isr_duration(uint8_t isr, unsigned long entry_micros);
+
+// Called from the main loop
+void print_diagnostics();
+unsigned long diag_worst_isr_micros(uint8_t isr);
+unsigned long diag_events_dropped();
+
+#endif
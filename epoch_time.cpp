@@ -0,0 +1,35 @@
+// Conversions between epoch time and the time-of-day fields that we display and record
+#include "epoch_time.h"
+
+// Seconds since the epoch at midnight (UTC) at the start of the given date
+unsigned long epoch_seconds_from_date(int year, byte month, byte day) {
+  // days_from_civil, http://howardhinnant.github.io/date_algorithms.html
+  long y = year - (month <= 2 ? 1 : 0);
+  long era = y / 400;
+  long year_of_era = y - (era * 400);
+  long day_of_year = ((153 * (month + (month > 2 ? -3 : 9))) + 2) / 5 + day - 1;
+  long day_of_era = (year_of_era * 365) + (year_of_era / 4) - (year_of_era / 100) + day_of_year;
+  long days = (era * 146097) + day_of_era - 719468;
+  return days * SECONDS_PER_DAY;
+}
+
+// Fill in the TimeResult, without any 64-bit divisions (safe to use in interrupts)
+void time_result_from_seconds(TimeResult *output, unsigned long epoch_seconds, unsigned long sub_second_micros) {
+  output->epoch_micros = ((EpochMicros)epoch_seconds * MICROS_PER_SECOND) + sub_second_micros;
+
+  unsigned long day_seconds = epoch_seconds % SECONDS_PER_DAY;
+  output->hour = day_seconds / 3600;
+  output->minute = (day_seconds / 60) % 60;
+  output->second = day_seconds % 60;
+  output->millisecond = sub_second_micros / 1000;
+  output->microsecond = sub_second_micros % 1000;
+}
+
+void time_result_from_epoch(TimeResult *output, EpochMicros epoch_micros) {
+  time_result_from_seconds(output, epoch_micros / MICROS_PER_SECOND, epoch_micros % MICROS_PER_SECOND);
+}
+
+// Midnight (UTC) at the start of the day
+unsigned long epoch_day_start(unsigned long epoch_seconds) {
+  return epoch_seconds - (epoch_seconds % SECONDS_PER_DAY);
+}
@@ -0,0 +1,28 @@
+#ifndef EPOCH_TIME_H
+#define EPOCH_TIME_H
+#include <Arduino.h>
+
+// Microseconds since 1970-01-01 00:00:00 UTC.
+// All timestamps are kept in this form, so that ordering and subtraction
+// work across midnight, and across days.
+typedef int64_t EpochMicros;
+
+#define MICROS_PER_SECOND 1000000LL
+#define SECONDS_PER_DAY 86400UL
+
+typedef struct {
+  EpochMicros epoch_micros; // the time, the fields below are derived from it
+  byte hour; // hour-of-day
+  byte minute;
+  byte second;
+  int millisecond;
+  int microsecond; // 0-999, the part of the time below `millisecond`
+  unsigned long error_micros; // how far from the true time this may be
+} TimeResult;
+
+unsigned long epoch_seconds_from_date(int year, byte month, byte day);
+void time_result_from_seconds(TimeResult *output, unsigned long epoch_seconds, unsigned long sub_second_micros);
+void time_result_from_epoch(TimeResult *output, EpochMicros epoch_micros);
+unsigned long epoch_day_start(unsigned long epoch_seconds);
+
+#endif
@@ -0,0 +1,98 @@
+// - Event log, see event_log.h
+#include "event_log.h"
+#include "uni_sd.h"
+#include "serial_log.h"
+
+extern UniSd sd;
+
+uint8_t _log_level = LOG_DEFAULT_LEVEL;
+unsigned long _log_segment = 1;
+unsigned long _log_segment_bytes = 0;
+char _log_filename[LOG_FILENAME_LENGTH] = "log_1.txt";
+
+// Segment numbers wrap around after LOG_SEGMENT_NUMBERS (about 1.3TB of log), so the name fits
+void log_segment_filename(char *filename, unsigned long segment) {
+  snprintf(filename, LOG_FILENAME_LENGTH, "log_%lu.txt", segment % LOG_SEGMENT_NUMBERS);
+}
+
+// The index has one line per segment, the last one is the current segment
+bool _log_index_found = false;
+void log_read_index_line(char *line) {
+  unsigned long segment = strtoul(line, NULL, 10);
+  if (segment > 0) {
+    _log_segment = segment;
+    _log_index_found = true;
+  }
+}
+
+void log_write_index() {
+  char line[40];
+  snprintf(line, sizeof(line), "%lu,%s,%lu", _log_segment, _log_filename, millis());
+  sd.writeFile(LOG_INDEX_FILE, line);
+}
+
+// Start a new segment, and delete the oldest one
+void log_rotate() {
+  // during a race the segment is preallocated (see preallocate_race_files), so the new
+  // one is too, and the old one's size is set to the data in it
+  bool preallocated = sd.preallocated(_log_filename);
+  sd.finishFile(_log_filename);
+
+  _log_segment++;
+  log_segment_filename(_log_filename, _log_segment);
+  _log_segment_bytes = 0;
+  log_write_index();
+  if (preallocated) {
+    sd.preallocate(_log_filename, LOG_SEGMENT_SIZE);
+  }
+  if (_log_segment > LOG_MAX_SEGMENTS) {
+    char oldest[LOG_FILENAME_LENGTH];
+    log_segment_filename(oldest, _log_segment - LOG_MAX_SEGMENTS);
+    sd.clearFile(oldest);
+  }
+}
+
+// Find the current segment (from the index), and how full it is
+void log_setup() {
+  _log_segment = 1;
+  _log_index_found = false;
+  sd.readLines(LOG_INDEX_FILE, log_read_index_line);
+  log_segment_filename(_log_filename, _log_segment);
+  if (!_log_index_found) {
+    log_write_index();
+  }
+  _log_segment_bytes = sd.fileSize(_log_filename);
+  SERIAL_INFO("Logging to %s", _log_filename);
+}
+
+void log_write(uint8_t level, const char *message) {
+  if (level < _log_level) {
+    return;
+  }
+  const char levels[] = "DIWE";
+  char line[LOG_LINE_LENGTH];
+  int length = snprintf(line, sizeof(line), "%c %lu %s", levels[level & 3], millis(), message);
+  if (length >= (int)sizeof(line)) {
+    length = sizeof(line) - 1;
+  }
+
+  if (_log_segment_bytes + length + 2 > LOG_SEGMENT_SIZE) {
+    log_rotate();
+  }
+  _log_segment_bytes += length + 2;
+  // not synced on every line, so that it doesn't delay the results (see UniSd::loop)
+  sd.queueWrite(_log_filename, line, false);
+}
+
+void log_set_level(uint8_t level) {
+  _log_level = level;
+}
+
+uint8_t log_level() {
+  return _log_level;
+}
+
+// The current segment
+const char *log_filename() {
+  return _log_filename;
+}
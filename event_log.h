@@ -0,0 +1,48 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+#include <Arduino.h>
+
+// Event log on the SD card.
+//
+// Each line is: <level> <millis> <message>
+// The log is split into numbered segments (log_1.txt, log_2.txt, ...) of about
+// LOG_SEGMENT_SIZE bytes. Only the newest LOG_MAX_SEGMENTS are kept, and
+// LOG_INDEX_FILE lists the segments (number,filename,millis when started).
+
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARNING 2
+#define LOG_ERROR 3
+
+// Messages below this level are removed when compiling
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_DEBUG
+#endif
+// Messages below this level are ignored at run time (see log_set_level)
+#define LOG_DEFAULT_LEVEL LOG_INFO
+
+#define LOG_SEGMENT_SIZE 131072UL
+#define LOG_MAX_SEGMENTS 8
+#define LOG_INDEX_FILE "log_idx.txt"
+// Longer messages are cut short, so that every line costs about the same
+#define LOG_LINE_LENGTH 100
+#define LOG_FILENAME_LENGTH 16
+#define LOG_SEGMENT_NUMBERS 10000000UL // log_9999999.txt is the longest name
+
+void log_setup();
+void log_write(uint8_t level, const char *message);
+void log_set_level(uint8_t level);
+uint8_t log_level();
+const char *log_filename();
+
+// Add a message to the event log (written in the background, see UniSd::queueWrite)
+static inline void log(uint8_t level, const char *message) {
+#if LOG_COMPILED_LEVEL > LOG_DEBUG
+  if (level < LOG_COMPILED_LEVEL) {
+    return;
+  }
+#endif
+  log_write(level, message);
+}
+
+#endif
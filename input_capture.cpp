@@ -0,0 +1,160 @@
+// Timestamping of the sensor and PPS edges
+#include "input_capture.h"
+
+typedef struct {
+  int pin; // -1 when the slot is free
+  capture_handler handler;
+  int8_t channel; // TPM0 channel, -1 when using attachInterrupt
+} CaptureSlot;
+
+CaptureSlot capture_slots[INPUT_CAPTURE_SLOTS] = {
+  { -1, NULL, -1 },
+  { -1, NULL, -1 }
+};
+
+/* ******************* SOFTWARE FALLBACK ******************* */
+// attachInterrupt() handlers don't take arguments, so we need one per slot
+void software_capture_0() {
+  unsigned long now = micros();
+  capture_slots[0].handler(now);
+}
+
+void software_capture_1() {
+  unsigned long now = micros();
+  capture_slots[1].handler(now);
+}
+
+void (*software_capture_isr[INPUT_CAPTURE_SLOTS])() = { &software_capture_0, &software_capture_1 };
+
+/* ******************* HARDWARE CAPTURE ******************* */
+#ifdef INPUT_CAPTURE_HARDWARE
+// TPM0 runs at 48MHz / 16 = 3 ticks per microsecond, and wraps every ~21ms
+#define CAPTURE_TICKS_PER_MICRO 3
+#define CAPTURE_CHANNEL_SC(channel) ((&FTM0_C0SC)[(channel) * 2])
+#define CAPTURE_CHANNEL_V(channel) ((&FTM0_C0V)[(channel) * 2])
+
+// Teensy LC pins which can be connected to a TPM0 channel (all on mux ALT4)
+typedef struct {
+  uint8_t pin;
+  uint8_t channel;
+} CapturePin;
+
+const CapturePin capture_pins[] = {
+  { 2, 0 }, // PTD0
+  { 22, 0 }, // PTC1
+  { 23, 1 }, // PTC2
+  { 9, 2 }, // PTC3
+  { 10, 3 }, // PTC4
+  { 6, 4 }, // PTD4
+  { 20, 5 }, // PTD5
+};
+
+bool capture_timer_running = false;
+
+int8_t hardware_channel(int pin) {
+  for (unsigned int i = 0; i < sizeof(capture_pins) / sizeof(capture_pins[0]); i++) {
+    if (capture_pins[i].pin == pin) {
+      return capture_pins[i].channel;
+    }
+  }
+  return -1;
+}
+
+// The counter value was latched when the edge happened,
+// so we subtract the time since then from the current micros()
+void hardware_capture_isr() {
+  unsigned long now = micros();
+  uint16_t count = FTM0_CNT;
+  for (int i = 0; i < INPUT_CAPTURE_SLOTS; i++) {
+    int8_t channel = capture_slots[i].channel;
+    if (channel < 0 || !(CAPTURE_CHANNEL_SC(channel) & FTM_CSC_CHF)) {
+      continue;
+    }
+    uint16_t latched = CAPTURE_CHANNEL_V(channel);
+    CAPTURE_CHANNEL_SC(channel) |= FTM_CSC_CHF; // write 1 to clear
+    uint16_t elapsed_ticks = count - latched;
+    capture_slots[i].handler(now - (elapsed_ticks / CAPTURE_TICKS_PER_MICRO));
+  }
+}
+
+void start_capture_timer() {
+  if (capture_timer_running) {
+    return;
+  }
+  // NOTE: this takes TPM0 away from analogWrite() on pins 6, 9, 10, 20, 22, 23
+  FTM0_SC = 0;
+  FTM0_CNT = 0;
+  FTM0_MOD = 0xFFFF;
+  FTM0_SC = FTM_SC_CMOD(1) | FTM_SC_PS(4);
+  attachInterruptVector(IRQ_FTM0, &hardware_capture_isr);
+  NVIC_ENABLE_IRQ(IRQ_FTM0);
+  capture_timer_running = true;
+}
+
+uint32_t capture_edge_bits(int mode) {
+  switch(mode) {
+    case RISING:
+      return FTM_CSC_ELSA;
+    case FALLING:
+      return FTM_CSC_ELSB;
+  }
+  return FTM_CSC_ELSA | FTM_CSC_ELSB;
+}
+#endif
+
+/* ******************* PUBLIC METHODS ******************* */
+bool capture_attach(int pin, capture_handler handler, int mode) {
+  capture_detach(pin);
+  for (int i = 0; i < INPUT_CAPTURE_SLOTS; i++) {
+    if (capture_slots[i].pin != -1) {
+      continue;
+    }
+    capture_slots[i].handler = handler;
+    capture_slots[i].channel = -1;
+#ifdef INPUT_CAPTURE_HARDWARE
+    int8_t channel = hardware_channel(pin);
+    if (channel >= 0) {
+      start_capture_timer();
+      capture_slots[i].channel = channel;
+      CAPTURE_CHANNEL_SC(channel) = FTM_CSC_CHF | FTM_CSC_CHIE | capture_edge_bits(mode);
+      *portConfigRegister(pin) = PORT_PCR_MUX(4);
+      capture_slots[i].pin = pin;
+      return true;
+    }
+#endif
+    attachInterrupt(digitalPinToInterrupt(pin), software_capture_isr[i], mode);
+    capture_slots[i].pin = pin;
+    return true;
+  }
+  return false;
+}
+
+void capture_detach(int pin) {
+  for (int i = 0; i < INPUT_CAPTURE_SLOTS; i++) {
+    if (capture_slots[i].pin != pin) {
+      continue;
+    }
+#ifdef INPUT_CAPTURE_HARDWARE
+    int8_t channel = capture_slots[i].channel;
+    if (channel >= 0) {
+      CAPTURE_CHANNEL_SC(channel) = FTM_CSC_CHF; // disable the channel
+      pinMode(pin, INPUT); // back to a GPIO
+    } else {
+      detachInterrupt(digitalPinToInterrupt(pin));
+    }
+#else
+    detachInterrupt(digitalPinToInterrupt(pin));
+#endif
+    capture_slots[i].pin = -1;
+    capture_slots[i].channel = -1;
+  }
+}
+
+bool capture_is_hardware(int pin) {
+  for (int i = 0; i < INPUT_CAPTURE_SLOTS; i++) {
+    if (capture_slots[i].pin == pin) {
+      return capture_slots[i].channel >= 0;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,48 @@
+#ifndef INPUT_CAPTURE_H
+#define INPUT_CAPTURE_H
+#include <Arduino.h>
+#include "diagnostics.h"
+
+// On the Teensy LC, the TPM0 timer can latch its counter in hardware when an
+// input pin changes, so the timestamp doesn't depend on how long it took to
+// get into the interrupt. Comment this out to always use attachInterrupt.
+#if defined(KINETISL)
+#define INPUT_CAPTURE_HARDWARE
+#endif
+
+#define INPUT_CAPTURE_SLOTS 2
+// The software fallback timestamps an edge when its interrupt gets to micros(). This is how
+// much later than the edge that can be, not counting the capture interrupts themselves
+// (getting into the interrupt, and the other interrupts, e.g. SysTick and the serial ports).
+// Estimated for the Teensy LC, see tools/input_capture_sim.cpp
+#define INPUT_CAPTURE_SOFTWARE_LATENCY_MICROS 25
+
+// Called (in interrupt context) with the micros() at which the edge happened
+typedef void (*capture_handler)(unsigned long captured_micros);
+
+// Start timestamping edges (RISING, FALLING or CHANGE) on the pin.
+// Uses the hardware capture if the pin supports it, otherwise attachInterrupt + micros()
+// return false if there are no free slots
+bool capture_attach(int pin, capture_handler handler, int mode);
+void capture_detach(int pin);
+// Is this pin being timestamped by the hardware
+bool capture_is_hardware(int pin);
+
+// How much later than the edge a timestamp from this pin may be, to add to its error bound:
+// 0 for the hardware capture. For the software fallback, INPUT_CAPTURE_SOFTWARE_LATENCY_MICROS
+// plus the longest that the capture interrupts have been measured to run (the edge may
+// happen while one of them is running, see diag_isr_duration).
+static inline unsigned long capture_latency_bound(int pin) {
+  if (capture_is_hardware(pin)) {
+    return 0;
+  }
+  unsigned long worst_isr = 0;
+  for (uint8_t isr = 0; isr < DIAG_ISR_COUNT; isr++) {
+    if (diag_worst_isr_micros(isr) > worst_isr) {
+      worst_isr = diag_worst_isr_micros(isr);
+    }
+  }
+  return INPUT_CAPTURE_SOFTWARE_LATENCY_MICROS + worst_isr;
+}
+
+#endif
@@ -0,0 +1,131 @@
+// - Crash-safe result journal, see journal.h
+#include "journal.h"
+#include "uni_sd.h"
+#include "crc16.h"
+#include "serial_log.h"
+
+extern UniSd sd;
+
+char journal_filename[JOURNAL_FILENAME_LENGTH] = "";
+unsigned long journal_sequence = 0;
+journal_handler journal_replay_handler = NULL;
+unsigned long journal_replayed = 0;
+unsigned long journal_corrupt = 0;
+
+// return false if the line isn't a valid record
+bool journal_parse(char *line, JournalRecord *record) {
+  char *star = strrchr(line, '*');
+  if (star == NULL) {
+    return false;
+  }
+  if (strtoul(star + 1, NULL, 16) != crc16_ccitt(line, star - line)) {
+    return false;
+  }
+  char *position = line;
+  record->sequence = strtoul(position, &position, 10);
+  if (*position++ != ',') return false;
+  record->type = *position++;
+  if (*position++ != ',') return false;
+  record->racer_number = strtol(position, &position, 10);
+  if (*position++ != ',') return false;
+  unsigned long seconds = strtoul(position, &position, 10);
+  if (*position++ != '.') return false;
+  unsigned long sub_second = strtoul(position, &position, 10);
+  if (*position++ != ',') return false;
+  record->epoch_micros = ((EpochMicros)seconds * MICROS_PER_SECOND) + sub_second;
+  record->error_micros = strtoul(position, &position, 10);
+  if (*position++ != ',') return false;
+  record->fault = strtoul(position, &position, 10) != 0;
+  if (*position++ != ',') return false;
+  record->line = strtoul(position, &position, 10);
+  return position == star;
+}
+
+void journal_replay_line(char *line) {
+  JournalRecord record;
+  if (!journal_parse(line, &record) || record.sequence <= journal_sequence) {
+    SERIAL_WARNING("Skipping journal line: %s", line);
+    journal_corrupt++;
+    return;
+  }
+  journal_sequence = record.sequence;
+  journal_replayed++;
+  journal_replay_handler(&record);
+}
+
+// The race filename, with another extension (e.g. ".jnl")
+void journal_filename_for(char *filename, const char *race_filename, const char *new_extension) {
+  strncpy(filename, race_filename, JOURNAL_FILENAME_LENGTH - 1);
+  filename[JOURNAL_FILENAME_LENGTH - 1] = '\0';
+  char *extension = strrchr(filename, '.');
+  if (extension != NULL && strlen(extension) == 4) {
+    strcpy(extension, new_extension);
+  }
+}
+
+// Use the journal which belongs to the given race file
+void journal_open(const char *race_filename) {
+  journal_filename_for(journal_filename, race_filename, ".jnl");
+  journal_sequence = 0;
+}
+
+// Mark the race as in progress (see journal.h)
+bool journal_begin_race(const char *race_filename) {
+  char filename[JOURNAL_FILENAME_LENGTH];
+  char line[] = "in progress";
+  journal_filename_for(filename, race_filename, ".run");
+  if (sd.fileSize(filename) > 0) {
+    return true;
+  }
+  return sd.writeFile(filename, line);
+}
+
+// The race was finished, or the mode was left
+bool journal_end_race(const char *race_filename) {
+  char filename[JOURNAL_FILENAME_LENGTH];
+  journal_filename_for(filename, race_filename, ".run");
+  return sd.clearFile(filename);
+}
+
+// Was the race in progress when the power was lost?
+bool journal_race_in_progress(const char *race_filename) {
+  char filename[JOURNAL_FILENAME_LENGTH];
+  journal_filename_for(filename, race_filename, ".run");
+  return sd.fileSize(filename) > 0;
+}
+
+// Write the record (giving it the next sequence number), and make sure it is on the card
+// return true on success
+bool journal_append(JournalRecord *record) {
+  char line[SD_LINE_LENGTH];
+  record->sequence = journal_sequence + 1;
+  // printf on this board doesn't do 64-bit numbers, so the time is written as seconds.micros
+  int length = snprintf(line, sizeof(line) - 5, "%lu,%c,%d,%lu.%06lu,%lu,%d,%lu",
+    record->sequence, record->type, record->racer_number,
+    (unsigned long)(record->epoch_micros / MICROS_PER_SECOND),
+    (unsigned long)(record->epoch_micros % MICROS_PER_SECOND),
+    record->error_micros, record->fault ? 1 : 0, record->line);
+  snprintf(line + length, sizeof(line) - length, "*%04X", crc16_ccitt(line, length));
+  // the race file lines queued before this are still written by sd.loop()
+  if (!sd.writeFileNow(journal_filename, line)) {
+    return false;
+  }
+  journal_sequence = record->sequence;
+  return true;
+}
+
+// Call the handler for each valid record in the journal, in order
+// return the number of records replayed
+unsigned long journal_replay(journal_handler handler) {
+  journal_replay_handler = handler;
+  journal_replayed = 0;
+  journal_corrupt = 0;
+  journal_sequence = 0;
+  // a torn last record would corrupt the next one that we append
+  if (sd.repairFile(journal_filename) <= 0) {
+    return 0;
+  }
+  sd.readLines(journal_filename, journal_replay_line);
+  SERIAL_INFO("Journal records replayed: %lu skipped: %lu", (unsigned long)journal_replayed, (unsigned long)journal_corrupt);
+  return journal_replayed;
+}
@@ -0,0 +1,44 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+#include <Arduino.h>
+#include "epoch_time.h"
+
+// Each race file has a journal next to it (.txt -> .jnl), which is written (and synced)
+// before a result is acknowledged. After a power cut, the journal is replayed to
+// rebuild the race file, the recent results, and the mode 6 times waiting for a racer number.
+//
+// One record per line: sequence,type,racer,seconds.micros,error,fault,line*CRC
+// e.g. 12,R,123,1589039296.123456,12,0,10*1A2B
+// Records with a bad CRC (torn writes) are skipped.
+
+#define JOURNAL_RESULT 'R'         // a result was written to the race file
+#define JOURNAL_CLEAR_PREVIOUS 'C' // CLEAR_PREVIOUS was written to the race file
+#define JOURNAL_PENDING 'P'        // mode 6: a time is waiting for a racer number
+#define JOURNAL_DROP_PENDING 'X'   // mode 6: the last waiting time was removed
+
+#define JOURNAL_FILENAME_LENGTH 40
+
+typedef struct {
+  unsigned long sequence;
+  char type;
+  int racer_number;
+  EpochMicros epoch_micros;
+  unsigned long error_micros;
+  bool fault;
+  unsigned long line; // line of the race file which this record was written to
+} JournalRecord;
+
+typedef void (*journal_handler)(JournalRecord *record);
+
+void journal_open(const char *race_filename);
+bool journal_append(JournalRecord *record);
+unsigned long journal_replay(journal_handler handler);
+
+// A race is in progress from when mode 5/6 is started until it is left. This is marked by a
+// file next to the race file (.txt -> .run), so that after a power cut we know that the race
+// should be resumed straight away (see fast_resume).
+bool journal_begin_race(const char *race_filename);
+bool journal_end_race(const char *race_filename);
+bool journal_race_in_progress(const char *race_filename);
+
+#endif
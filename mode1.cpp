@@ -3,6 +3,7 @@
 #include "uni_sensor.h"
 #include "uni_display.h"
 #include "modes.h"
+#include "serial_log.h"
 
 extern UniDisplay display;
 extern UniKeypad keypad;
@@ -27,8 +28,7 @@ void mode1_loop() {
     if (key != last_key) {
       // New Keypress
       display.show(key);
-      Serial.println("Number");
-      Serial.println(key);
+      SERIAL_DEBUG("Number %c", key);
     }
   }
   last_key = key;
@@ -3,6 +3,7 @@
 #include "uni_display.h"
 #include "uni_sd.h"
 #include "modes.h"
+#include "serial_log.h"
 
 extern UniKeypad keypad;
 extern UniGps gps;
@@ -15,9 +16,13 @@ extern UniSd sd;
 // - If you press B, it will display the # chars received from GPS
 // - If you press A, it will show the GPS time (if GPS signal found), otherwise it will wait for lock, and beep positively.
 //- If you press C, it will test writing/reading from the SD card, and display either 6ood or bAd
+//- If you press D, it will show the clock health, each press shows the next value:
+//  estimated error (us), seconds since the last PPS, missed PPS pulses, checksum failures per minute
 unsigned long gps_millis = 0;
 char last_key2 = NO_KEY;
 int subMode = 0;
+int healthPage = 0;
+#define HEALTH_PAGES 4
 void mode2_loop() {
   if (gps_millis == 0 || (millis() - gps_millis > 1000)) {
     // Run inner loop periodically
@@ -25,7 +30,7 @@ void mode2_loop() {
       // A - show GPS date, if locked
       if (gps.lock()) {
         TimeResult time;
-        gps.current_time(&time, millis());
+        gps.current_time(&time, micros());
         display.showNumber((time.minute * 100) + time.second, DEC);
       } else {
         // no lock
@@ -37,11 +42,31 @@ void mode2_loop() {
       // B - show # chars from GPS
       long chars = gps.charactersReceived();
       display.showNumber(chars % 10000, DEC);
-      char stuff[100];
-      sprintf(stuff, "Outputting %ld", chars);
-      Serial.println(stuff);
+      SERIAL_INFO("Outputting %ld", chars);
     } else if (subMode == 3) {
       // C - show SD Good/bad (TBD)
+    } else if (subMode == 4) {
+      // D - show clock health
+      ClockHealth health;
+      gps.health(&health);
+      unsigned long value;
+      if (healthPage == 0) {
+        value = health.error_micros;
+      } else if (healthPage == 1) {
+        value = (health.millis_since_pps == 0xFFFFFFFF) ? 0xFFFFFFFF : health.millis_since_pps / 1000;
+      } else if (healthPage == 2) {
+        value = health.missed_pulses;
+      } else {
+        value = health.checksum_failures_per_minute;
+      }
+      if (value > 9999) {
+        display.showNumber(9999, DEC);
+      } else {
+        display.showNumber(value, DEC);
+      }
+      SERIAL_INFO("Clock err %lu us, PPS age %lu ms, missed %lu, extra %lu, csum/min %u",
+        health.error_micros, health.millis_since_pps, health.missed_pulses,
+        health.extra_pulses, health.checksum_failures_per_minute);
     }
     gps_millis = millis();
 
@@ -67,6 +92,18 @@ void mode2_loop() {
         } else {
           display.bad();
         }
+        SERIAL_INFO("SD last write us: %lu worst write us: %lu", sd.lastWriteMicros(), sd.worstWriteMicros());
+        sd.printLatency();
+      }
+      if (keynum == 20) {
+        // D
+        if (subMode == 4) {
+          healthPage = (healthPage + 1) % HEALTH_PAGES;
+        } else {
+          healthPage = 0;
+        }
+        subMode = 4;
+        gps_millis = 0; // show it straight away
       }
     }
   }   
@@ -4,6 +4,7 @@
 #include "modes.h"
 
 #include "recording.h"
+#include "race_results.h"
 
 extern UniKeypad keypad;
 extern UniDisplay display;
@@ -14,6 +15,7 @@ void filename_config(char key);
 void racer_digits_config(char key);
 void start_line_config(char key);
 void finish_line_config(char key);
+void results_config(char key);
 
 
 //### Mode 4.1 - Race Setup
@@ -48,6 +50,9 @@ void mode4_loop() {
         case '4':
           config_mode = 4;
           break;
+        case '5':
+          config_mode = 5;
+          break;
       }
       switch(config_mode) {
         case 1:
@@ -62,6 +67,9 @@ void mode4_loop() {
         case 4:
           finish_line_config(key);
           break;
+        case 5:
+          results_config(key);
+          break;
       }
     }
   }
@@ -71,6 +79,7 @@ void mode4_loop() {
 
 void mode4_teardown() {
   config.writeConfig();
+  preallocate_race_files();
 }
 
 void racer_digits_config(char key) {
@@ -106,6 +115,22 @@ void finish_line_config(char key) {
   display.showNumber(config.get_finish_line_spacing());
 }
 
+// Compute the results of the race (needs the start and finish files on this SD card)
+// shows the number of racers, or bAd
+void results_config(char key) {
+  if (key == 'A') {
+    display.waiting(true);
+    long count = compute_race_results();
+    if (count < 0) {
+      display.bad();
+    } else {
+      display.showNumber(count);
+    }
+  } else if (key == '5') {
+    display.clear();
+  }
+}
+
 void filename_config(char key) {
   switch(key) {
   case 'A':
@@ -7,6 +7,7 @@
 #include "modes.h"
 #include "recording.h"
 #include "accurate_timing.h"
+#include "serial_log.h"
 
 extern UniKeypad keypad;
 extern UniGps gps;
@@ -73,11 +74,11 @@ void initial_check() {
     buzzer.beep();
     display.sens();
   } else if (keypad.keyPressed('D') && keypad.keyPressed('#')) { // D+#
-    log("Clear previous entry");
+    log(LOG_DEBUG, "Clear previous entry");
     clear_previous_entry();
   }
 #ifdef FSM_DEBUG
-  Serial.println("Initial Check ");
+  SERIAL_INFO("Initial Check");
 #endif
 }
 
@@ -96,25 +97,29 @@ void digit_check() {
     mode5_fsm.trigger(ACCEPT);
   } else if (last_key_pressed == 'C') {
     mode5_fsm.trigger(DELETE);
-    log("CLEARED RACER NUMBER");
+    log(LOG_DEBUG, "CLEARED RACER NUMBER");
   } else if (sensor.blocked()) {
     TimeResult data;
     currentTime(&data);
-    print_data_to_log(data);
+    // polled while the sensor is blocked, so this is logged many times
+    print_data_to_log(data, false, LOG_DEBUG);
     buzzer.beep();
     display.sens();
   }
 #ifdef FSM_DEBUG
-  Serial.println("Digit Check");
+  SERIAL_INFO("Digit Check");
 #endif
 }
 
 void countdown(); // forward declaration
 
 void sensor_check() {
+  if (duplicate_warning_ended()) {
+    display.showNumber(racer_number());
+  }
   if (keypad.newKeyPressed() && keypad.keyPressed('C')) {
     mode5_fsm.trigger(DELETE);
-    log("DELETED RACER NUMBER");
+    log(LOG_DEBUG, "DELETED RACER NUMBER");
   } else if (sensor_has_triggered()) {
     mode5_fsm.trigger(SENSOR);
   } else if (config.get_start_line_countdown()) {
@@ -122,7 +127,7 @@ void sensor_check() {
     countdown();
   }
 #ifdef FSM_DEBUG
-  Serial.println("Sensor Check");
+  SERIAL_INFO("Sensor Check");
 #endif
 }
 
@@ -136,7 +141,7 @@ uint8_t countdown_step = 0;
 void countdown() {
   if (countdown_start_time == 0) {
     // start the countdown
-    Serial.println("Restarting countdown");
+    SERIAL_DEBUG("Restarting countdown");
     countdown_start_time = millis();
     buzzer.pre_beep(); // beep for 0.5 second for each tone
     countdown_step = 1;
@@ -159,8 +164,7 @@ void countdown() {
 // the final BEEP has triggered, and the sensor has not been crossed
 // THUS we store the current time, no fault
 void start_beeped() {
-  Serial.println("START BEEPED");
-  Serial.println(millis());
+  SERIAL_INFO("START BEEPED %lu", millis());
   TimeResult data;
   currentTime(&data);
 
@@ -172,19 +176,19 @@ void start_beeped() {
   }
 
   clear_racer_number();
-  clear_sensor_interrupt_millis();
+  clear_sensor_crossings();
 }
 
 // This is the FSM action which occurs after
 // we notice that the sensor interrupt has fired.
 void sensor_triggered() {
-  Serial.println("SENSOR TRIGGERED 5");
-  Serial.println(sensor_interrupt_millis());
-  
+  SERIAL_DEBUG("SENSOR TRIGGERED 5");
+
   display.sens();
   
+  // Only one racer starts at a time, any later crossings are dropped below
   TimeResult data;
-  lastSensorTime(&data);
+  nextSensorTime(&data);
   // QUESTION: If someone faults, what time should be recorded? Their ACTUAL start time + penalty, right?
   if (config.get_start_line_countdown()) {
     if (print_racer_data_to_sd(racer_number(), data, true)) {
@@ -205,18 +209,23 @@ void sensor_triggered() {
   print_data_to_log(data);
   
   clear_racer_number();
-  clear_sensor_interrupt_millis();
+  clear_sensor_crossings();
 }
 
 void sensor_entry() {
-  log("ACCEPTED");
-  clear_sensor_interrupt_millis();
+  log(LOG_DEBUG, "ACCEPTED");
+  clear_sensor_crossings();
+  if (duplicate_racer_number(racer_number())) {
+    // still allowed (e.g. a re-run), but make sure that the judge knows
+    show_duplicate_warning();
+  }
   display.setBlink(true);
 }
 
 void sensor_exit() {
-  Serial.println("exiting");
+  SERIAL_DEBUG("exiting");
   display.setBlink(false);
+  cancel_duplicate_warning();
   countdown_start_time = 0;
 }
 
@@ -251,9 +260,10 @@ void mode5_setup() {
     mode5_fsm_setup();
     fsm_5_transition_setup_complete = true;
   }
-  Serial.println("starting mode 5");
+  SERIAL_INFO("starting mode 5");
   display.clear();
   sensor.attach_interrupt();
+  mark_race_in_progress(true);
   // States:
   // INITIAL
   // DIGITS_ENTERED
@@ -288,4 +298,6 @@ void mode5_loop() {
 
 void mode5_teardown() {
   sensor.detach_interrupt();
+  finish_race_files();
+  mark_race_in_progress(false);
 }
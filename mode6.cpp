@@ -6,6 +6,7 @@
 #include "modes.h"
 #include "recording.h"
 #include "accurate_timing.h"
+#include "serial_log.h"
 
 extern UniKeypad keypad;
 extern UniGps gps;
@@ -49,13 +50,28 @@ Fsm mode6_fsm(&mode6_initial);
 TimeResult results_to_record[MAX_RESULTS];
 int results_count = 0;
 
+// Write a waiting time to the journal, so that it survives a power cut
+void journal_pending(char type, TimeResult *data) {
+  JournalRecord record;
+  memset(&record, 0, sizeof(record));
+  record.type = type;
+  if (data != NULL) {
+    record.epoch_micros = data->epoch_micros;
+    record.error_micros = data->error_micros;
+  }
+  if (!journal_append(&record)) {
+    SERIAL_ERROR("Error writing to journal");
+  }
+}
+
 void store_data_result(TimeResult *data) {
   if (results_count < MAX_RESULTS) {
+    journal_pending(JOURNAL_PENDING, data);
     results_to_record[results_count] = *data;
     results_count ++;
-    Serial.println("stored new result");
+    SERIAL_DEBUG("stored new result");
   } else {
-    Serial.println("Results cache is full");
+    SERIAL_ERROR("Results cache is full");
   }
 }
 
@@ -80,7 +96,8 @@ bool retrieve_data(TimeResult *data) {
 // Create a second entry of the most recently-recorded data
 void duplicate_entry() {
   if (results_count > 0 && (results_count < MAX_RESULTS)) {
-    results_to_record[results_count - 1] = results_to_record[results_count];
+    journal_pending(JOURNAL_PENDING, &results_to_record[results_count - 1]);
+    results_to_record[results_count] = results_to_record[results_count - 1];
     results_count += 1;
     buzzer.beep();
     display.showEntriesRemaining(results_count);
@@ -90,28 +107,68 @@ void duplicate_entry() {
 // If we want to remove an entry, for example: incorrectly counted 2 crossings.
 void drop_last_entry() {
   if (results_count > 0) {
+    journal_pending(JOURNAL_DROP_PENDING, NULL);
     results_count -= 1;
     display.showEntriesRemaining(results_count);
   }
 }
 
+// Forget all of the waiting times (before replaying the journal)
+void mode6_clear_results() {
+  results_count = 0;
+}
+
+// Rebuild the waiting times from a journal record (see replay_journal)
+void mode6_replay(JournalRecord *record) {
+  if (record->type == JOURNAL_PENDING) {
+    if (results_count < MAX_RESULTS) {
+      time_result_from_epoch(&results_to_record[results_count], record->epoch_micros);
+      results_to_record[results_count].error_micros = record->error_micros;
+      results_count++;
+    }
+  } else if (record->type == JOURNAL_DROP_PENDING) {
+    if (results_count > 0) {
+      results_count--;
+    }
+  } else if (record->type == JOURNAL_RESULT) {
+    // the result used the oldest waiting time
+    if (results_count > 0 && results_to_record[0].epoch_micros == record->epoch_micros) {
+      for (int i = 0; i < (results_count - 1); i++) {
+        results_to_record[i] = results_to_record[i + 1];
+      }
+      results_count--;
+    }
+  }
+}
+
+unsigned long reported_crossings_dropped = 0;
+
+// Store every crossing which the sensor interrupt has queued up,
+// so that a group of racers finishing together are all recorded
 void store_timing_data() {
-  Serial.println("SENSOR TRIGGERED");
-  Serial.println(sensor_interrupt_millis());
-  
+  SERIAL_DEBUG("SENSOR TRIGGERED");
+
   buzzer.beep();
 //  display.sens();
   TimeResult data;
-  lastSensorTime(&data);
-  store_data_result(&data);
+  while (nextSensorTime(&data)) {
+    store_data_result(&data);
+  }
 
-  clear_sensor_interrupt_millis();
+  if (sensor_crossings_dropped() != reported_crossings_dropped) {
+    reported_crossings_dropped = sensor_crossings_dropped();
+    SERIAL_WARNING("Sensor crossings dropped: %lu", reported_crossings_dropped);
+    log(LOG_WARNING, "SENSOR CROSSINGS DROPPED");
+  }
 }
 
 bool deleting = false;
 // While waiting for a new datapoint
 // Watch for sensor, etc
 void mode6_initial_check() {
+  if (duplicate_warning_ended()) {
+    display.showEntriesRemaining(results_count);
+  }
   if (sensor_has_triggered()) {
     mode6_fsm.trigger(SENSOR);
   }
@@ -128,12 +185,14 @@ void mode6_initial_check() {
     deleting = false;
   }
 #ifdef FSM_DEBUG
-  Serial.println("Initial Check ");
+  SERIAL_INFO("Initial Check");
 #endif
 }
 
 void mode6_initial_entry() {
-  display.showEntriesRemaining(results_count);
+  if (!duplicate_warning_showing()) {
+    display.showEntriesRemaining(results_count);
+  }
 }
 
 void mode6_initial_exit() {
@@ -155,17 +214,21 @@ void mode6_fsm_setup() {
 
 void mode6_setup() { 
   if (!fsm_6_transition_setup_complete)  {
-    Serial.println("Mode6 Setup complete");
+    SERIAL_INFO("Mode6 Setup complete");
     mode6_fsm_setup();
     fsm_6_transition_setup_complete = true;
   }
-  Serial.println("starting mode 6");
+  SERIAL_INFO("starting mode 6");
   display.clear();
+  clear_sensor_crossings();
   sensor.attach_interrupt(); 
+  mark_race_in_progress(true);
 }
 
 void mode6_teardown() {
   sensor.detach_interrupt();
+  finish_race_files();
+  mark_race_in_progress(false);
 }
 
 // When a digit has been entered, monitor for A, C, #
@@ -187,18 +250,23 @@ void mode6_digit_check() {
     mode6_fsm.trigger(ACCEPT);
   }
 #ifdef FSM_DEBUG
-  Serial.println("Digit Check ");
+  SERIAL_INFO("Digit Check");
 #endif
 }
 
 // Store the racer number and time together in a file
 void mode6_store_result() {
-  Serial.println("STORE RESULT");
-  
+  SERIAL_DEBUG("STORE RESULT");
+
   buzzer.beep();
   TimeResult data;
   if (retrieve_data(&data)) {
+    bool duplicate = duplicate_racer_number(racer_number());
     print_racer_data_to_sd(racer_number(), data);
     clear_racer_number();
+    if (duplicate) {
+      // still recorded, but make sure that the judge knows
+      show_duplicate_warning();
+    }
   }
 }
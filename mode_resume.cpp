@@ -3,6 +3,7 @@
 #include "uni_display.h"
 #include "uni_buzzer.h"
 #include "modes.h"
+#include "recording.h"
 
 extern UniKeypad keypad;
 extern UniGps gps;
@@ -15,6 +16,7 @@ extern Fsm mode_fsm;
 /*********************************************************************************** */
 //### Mode Resume - GPS lock requirement before entering Mode 5 or Mode 6
 //
+//- Replays the journal, to recover the results from before a power cut
 //- Displays a moving pattern while waiting for GPS lock
 //- Once GPS lock, moves into the target mode
 //
@@ -24,6 +26,7 @@ extern Fsm mode_fsm;
 
 void mode_resume_setup() {
   display.clear();
+  replay_journal();
 }
 void mode_resume_loop() {
   gps.readData();
@@ -34,5 +37,8 @@ void mode_resume_loop() {
   }
 }
 
-void mode_resume_teardown() {
+// Leaving to mode 1 (before GPS lock) ends the race. This is the transition to mode 1,
+// not the state's teardown, which also runs on the way to mode 5/6.
+void mode_resume_leave() {
+  mark_race_in_progress(false);
 }
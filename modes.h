@@ -1,4 +1,5 @@
 #pragma once
+#include "journal.h"
 
 void mode1_loop();
 
@@ -19,7 +20,9 @@ void mode6_fsm_setup();
 void mode6_setup();
 void mode6_loop();
 void mode6_teardown();
+void mode6_clear_results();
+void mode6_replay(JournalRecord *record);
 
 void mode_resume_setup();
 void mode_resume_loop();
-void mode_resume_teardown();
+void mode_resume_leave();
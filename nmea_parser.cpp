@@ -0,0 +1,294 @@
+// Minimal NMEA parser, for GPS time
+#include "nmea_parser.h"
+#include <ctype.h>
+
+NmeaParser::NmeaParser()
+{
+  _in_sentence = false;
+  _time = NMEA_INVALID_TIME;
+  _date = NMEA_INVALID_DATE;
+  _time_millis = 0;
+  _fix_millis = 0;
+  _fix_quality = 0;
+  _satellites = 0;
+  _last_sentence = NMEA_SENTENCE_OTHER;
+  _ack_command = -1;
+  _ack_flag = PMTK_ACK_INVALID;
+  _chars = 0;
+  _good_sentences = 0;
+  _failed_checksums = 0;
+}
+
+// Feed in one character from the GPS
+// return true when a valid RMC/GGA/ZDA sentence has been completed
+bool NmeaParser::encode(char c) {
+  _chars++;
+  switch(c) {
+    case '$':
+      startSentence();
+      return false;
+    case ',':
+      if (!_in_sentence || _in_checksum) {
+        return false;
+      }
+      _checksum ^= c;
+      endField();
+      _field++;
+      return false;
+    case '*':
+      if (!_in_sentence || _in_checksum) {
+        return false;
+      }
+      endField();
+      _in_checksum = true;
+      _position = 0;
+      _received_checksum = 0;
+      return false;
+    case '\r':
+    case '\n':
+      if (!_in_sentence) {
+        return false;
+      }
+      _in_sentence = false;
+      return endSentence();
+  }
+
+  if (!_in_sentence) {
+    return false;
+  }
+  if (_in_checksum) {
+    int8_t value = hexValue(c);
+    if (value < 0 || _position >= 2) {
+      // not a valid checksum
+      _position = 3;
+      return false;
+    }
+    _received_checksum = (_received_checksum << 4) | value;
+    _position++;
+    return false;
+  }
+  _checksum ^= c;
+  if (_position < NMEA_FIELD_LENGTH) {
+    _buffer[_position++] = c;
+  }
+  return false;
+}
+
+// ddmmyy, hhmmsscc, and the millis() since the time was received
+void NmeaParser::get_datetime(unsigned long *date, unsigned long *time, unsigned long *age) {
+  if (date) {
+    *date = _date;
+  }
+  if (time) {
+    *time = _time;
+  }
+  if (age) {
+    *age = _time == NMEA_INVALID_TIME ? NMEA_INVALID_AGE : millis() - _time_millis;
+  }
+}
+
+// millis() since the last sentence which said that we have a valid fix
+unsigned long NmeaParser::fixAge() {
+  if (_fix_millis == 0) {
+    return NMEA_INVALID_AGE;
+  }
+  return millis() - _fix_millis;
+}
+
+// 0 = no fix, 1 = GPS fix, 2 = DGPS fix (from GGA)
+uint8_t NmeaParser::fixQuality() {
+  return _fix_quality;
+}
+
+uint8_t NmeaParser::satellites() {
+  return _satellites;
+}
+
+// Same as TinyGPS::stats
+void NmeaParser::stats(unsigned long *chars, unsigned short *sentences, unsigned short *failed) {
+  if (chars) {
+    *chars = _chars;
+  }
+  if (sentences) {
+    *sentences = _good_sentences;
+  }
+  if (failed) {
+    *failed = _failed_checksums;
+  }
+}
+
+// The type of the last valid sentence (NMEA_SENTENCE_RMC, etc)
+uint8_t NmeaParser::lastSentence() {
+  return _last_sentence;
+}
+
+// Has the receiver acknowledged the command (e.g. 314 for PMTK314)
+// if so, flag is set to the result (PMTK_ACK_SUCCESS, etc), and the acknowledgement is consumed
+bool NmeaParser::ackReceived(int command, uint8_t *flag) {
+  if (_ack_command != command) {
+    return false;
+  }
+  *flag = _ack_flag;
+  _ack_command = -1;
+  return true;
+}
+
+/* ******************* PRIVATE METHODS ******************* */
+void NmeaParser::startSentence() {
+  _in_sentence = true;
+  _in_checksum = false;
+  _checksum = 0;
+  _field = 0;
+  _position = 0;
+  _sentence = NMEA_SENTENCE_OTHER;
+  _new_time = NMEA_INVALID_TIME;
+  _new_date = NMEA_INVALID_DATE;
+  _new_fix = false;
+  _new_fix_quality = 0;
+  _new_satellites = 0;
+  _zda_day = 0;
+  _zda_month = 0;
+  _new_ack_command = -1;
+  _new_ack_flag = PMTK_ACK_INVALID;
+}
+
+// Store the field which has just finished, if it is one we want
+void NmeaParser::endField() {
+  _buffer[_position] = '\0';
+  if (_field == 0) {
+    // address, e.g. GPRMC or GNRMC, the talker doesn't matter
+    if (_position == 5) {
+      const char *type = _buffer + 2;
+      if (strcmp(type, "RMC") == 0) {
+        _sentence = NMEA_SENTENCE_RMC;
+      } else if (strcmp(type, "GGA") == 0) {
+        _sentence = NMEA_SENTENCE_GGA;
+      } else if (strcmp(type, "ZDA") == 0) {
+        _sentence = NMEA_SENTENCE_ZDA;
+      }
+    } else if (strcmp(_buffer, "PMTK001") == 0) {
+      _sentence = NMEA_SENTENCE_PMTK_ACK;
+    }
+  } else if (_sentence == NMEA_SENTENCE_PMTK_ACK) {
+    if (_field == 1) {
+      _new_ack_command = parseNumber();
+    } else if (_field == 2) {
+      _new_ack_flag = parseNumber();
+    }
+  } else if (_field == 1 && _sentence != NMEA_SENTENCE_OTHER) {
+    _new_time = parseTime();
+  } else if (_sentence == NMEA_SENTENCE_RMC) {
+    if (_field == 2) {
+      _new_fix = _buffer[0] == 'A';
+    } else if (_field == 9 && _position == 6) {
+      _new_date = parseNumber();
+    }
+  } else if (_sentence == NMEA_SENTENCE_GGA) {
+    if (_field == 6) {
+      _new_fix_quality = parseNumber();
+    } else if (_field == 7) {
+      _new_satellites = parseNumber();
+    }
+  } else if (_sentence == NMEA_SENTENCE_ZDA) {
+    if (_field == 2) {
+      _zda_day = parseNumber();
+    } else if (_field == 3) {
+      _zda_month = parseNumber();
+    } else if (_field == 4 && _position == 4) {
+      _new_date = (_zda_day * 10000UL) + (_zda_month * 100UL) + (parseNumber() % 100);
+    }
+  }
+  _position = 0;
+}
+
+// The checksum has been received, keep the values if it matches
+bool NmeaParser::endSentence() {
+  if (!_in_checksum || _position != 2) {
+    _failed_checksums++;
+    return false;
+  }
+  if (_received_checksum != _checksum) {
+    _failed_checksums++;
+    return false;
+  }
+  _good_sentences++;
+
+  unsigned long now = millis();
+  switch(_sentence) {
+    case NMEA_SENTENCE_RMC:
+      if (!_new_fix || _new_time == NMEA_INVALID_TIME || _new_date == NMEA_INVALID_DATE) {
+        return false;
+      }
+      _fix_millis = now;
+      break;
+    case NMEA_SENTENCE_GGA:
+      _fix_quality = _new_fix_quality;
+      _satellites = _new_satellites;
+      if (_fix_quality > 0) {
+        _fix_millis = now;
+      }
+      _last_sentence = _sentence;
+      // no date in GGA, so don't update the time
+      return true;
+    case NMEA_SENTENCE_PMTK_ACK:
+      _ack_command = _new_ack_command;
+      _ack_flag = _new_ack_flag;
+      return false;
+    case NMEA_SENTENCE_ZDA:
+      // ZDA is sent even without a fix (from the receiver's RTC), only trust it with one
+      if (fixAge() > 5000 || _new_time == NMEA_INVALID_TIME || _new_date == NMEA_INVALID_DATE) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+  }
+  _time = _new_time;
+  _date = _new_date;
+  _time_millis = now;
+  _last_sentence = _sentence;
+  return true;
+}
+
+// hhmmss.ss -> hhmmsscc
+unsigned long NmeaParser::parseTime() {
+  if (_position < 6) {
+    return NMEA_INVALID_TIME;
+  }
+  unsigned long result = 0;
+  for (uint8_t i = 0; i < 6; i++) {
+    if (!isdigit(_buffer[i])) {
+      return NMEA_INVALID_TIME;
+    }
+    result = (result * 10) + (_buffer[i] - '0');
+  }
+  result *= 100;
+  if (_buffer[6] == '.' && isdigit(_buffer[7])) {
+    result += (_buffer[7] - '0') * 10;
+    if (isdigit(_buffer[8])) {
+      result += _buffer[8] - '0';
+    }
+  }
+  return result;
+}
+
+unsigned long NmeaParser::parseNumber() {
+  unsigned long result = 0;
+  for (uint8_t i = 0; i < _position && isdigit(_buffer[i]); i++) {
+    result = (result * 10) + (_buffer[i] - '0');
+  }
+  return result;
+}
+
+int8_t NmeaParser::hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
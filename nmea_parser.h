@@ -0,0 +1,87 @@
+#ifndef NMEA_PARSER_H
+#define NMEA_PARSER_H
+#include <Arduino.h>
+
+#define NMEA_INVALID_AGE 0xFFFFFFFF
+#define NMEA_INVALID_DATE 0
+#define NMEA_INVALID_TIME 0xFFFFFFFF
+// Longest field that we need to keep (the sentence address, e.g. GPRMC, or hhmmss.sss)
+#define NMEA_FIELD_LENGTH 12
+
+#define NMEA_SENTENCE_OTHER 0
+#define NMEA_SENTENCE_RMC 1
+#define NMEA_SENTENCE_GGA 2
+#define NMEA_SENTENCE_ZDA 3
+#define NMEA_SENTENCE_PMTK_ACK 4
+
+// PMTK001 acknowledgement flags
+#define PMTK_ACK_INVALID 0
+#define PMTK_ACK_UNSUPPORTED 1
+#define PMTK_ACK_FAILED 2
+#define PMTK_ACK_SUCCESS 3
+
+// Streaming NMEA parser, for only the sentences that we need for timing:
+// - RMC (date, time, and whether the fix is valid)
+// - GGA (fix quality, number of satellites)
+// - ZDA (date and time)
+// - PMTK001 (acknowledgement of a configuration command)
+// Every other sentence is only checksummed, and skipped.
+// Doesn't allocate any memory, or use any floating point.
+//
+// Dates and times are returned in the same format as TinyGPS: ddmmyy and hhmmsscc
+class NmeaParser
+{
+  public:
+    NmeaParser();
+    bool encode(char c);
+    void get_datetime(unsigned long *date, unsigned long *time, unsigned long *age);
+    unsigned long fixAge();
+    uint8_t fixQuality();
+    uint8_t satellites();
+    void stats(unsigned long *chars, unsigned short *sentences, unsigned short *failed);
+    uint8_t lastSentence();
+    bool ackReceived(int command, uint8_t *flag);
+  private:
+    // sentence being parsed
+    bool _in_sentence;
+    bool _in_checksum;
+    uint8_t _checksum;
+    uint8_t _received_checksum;
+    uint8_t _field;
+    uint8_t _position;
+    char _buffer[NMEA_FIELD_LENGTH + 1];
+    uint8_t _sentence;
+    unsigned long _new_time;
+    unsigned long _new_date;
+    bool _new_fix;
+    uint8_t _new_fix_quality;
+    uint8_t _new_satellites;
+    uint8_t _zda_day;
+    uint8_t _zda_month;
+    int _new_ack_command;
+    uint8_t _new_ack_flag;
+
+    // last valid values
+    unsigned long _time;
+    unsigned long _date;
+    unsigned long _time_millis;
+    unsigned long _fix_millis;
+    uint8_t _fix_quality;
+    uint8_t _satellites;
+    uint8_t _last_sentence;
+    int _ack_command; // -1 when there is no new acknowledgement
+    uint8_t _ack_flag;
+
+    unsigned long _chars;
+    unsigned short _good_sentences;
+    unsigned short _failed_checksums;
+
+    void startSentence();
+    void endField();
+    bool endSentence();
+    unsigned long parseTime();
+    unsigned long parseNumber();
+    int8_t hexValue(char c);
+};
+
+#endif
@@ -0,0 +1,238 @@
+// - Race results, by joining the start and finish files, see race_results.h
+#include "race_results.h"
+#include "uni_sd.h"
+#include "uni_config.h"
+#include "recording.h"
+#include "serial_log.h"
+
+extern UniSd sd;
+extern UniConfig config;
+
+#define RESULTS_FILENAME_LENGTH 40
+#define RESULTS_LINE_LENGTH 40
+
+#define RESULT_STARTED 0x01
+#define RESULT_FINISHED 0x02
+#define RESULT_FAULT 0x04
+
+#define RESULTS_HALF_DAY_MICROS (12LL * 60 * 60 * 1000000)
+
+// A race file, and the lines which are cancelled by CLEAR_PREVIOUS
+typedef struct {
+  char filename[RESULTS_FILENAME_LENGTH];
+  uint16_t cleared[RESULTS_MAX_CLEARED];
+  uint8_t cleared_count;
+} ResultsFile;
+
+// A racer in the chunk being joined
+typedef struct {
+  uint16_t bib;
+  uint8_t flags;
+  uint16_t start_us;
+  uint16_t finish_us;
+  uint32_t start_ms;
+  uint32_t finish_ms;
+} ResultsEntry;
+
+// Everything used while computing the results, on the stack so that it only
+// uses RAM while the results are being computed
+typedef struct {
+  ResultsFile files[2]; // start, finish
+  // lines (of the file being read) which haven't been cleared yet, the most recent last
+  uint16_t undo[RESULTS_UNDO_DEPTH];
+  uint8_t undo_count;
+  uint16_t line_number;
+  ResultsFile *file;
+  bool finish;
+  // the chunk: the lowest bibs after last_bib, in bib order
+  int last_bib;
+  int entry_count;
+  ResultsEntry entries[RESULTS_CHUNK_RACERS];
+} ResultsJoin;
+
+ResultsJoin *join = NULL;
+
+// Milliseconds since midnight of the race day
+uint32_t race_millis(TimeResult *data) {
+  return (((uint32_t)data->hour * 60 + data->minute) * 60 + data->second) * 1000UL + data->millisecond;
+}
+
+bool is_cleared(ResultsFile *file, uint16_t line_number) {
+  for (int i = 0; i < file->cleared_count; i++) {
+    if (file->cleared[i] == line_number) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// First pass over each file: find the lines which CLEAR_PREVIOUS cancels
+void find_cleared_line(char *line) {
+  int bib;
+  TimeResult data;
+  bool fault;
+  uint16_t line_number = join->line_number++;
+  if (parse_race_line(line, &bib, &data, &fault)) {
+    if (join->undo_count == RESULTS_UNDO_DEPTH) {
+      memmove(&join->undo[0], &join->undo[1], sizeof(join->undo[0]) * (RESULTS_UNDO_DEPTH - 1));
+      join->undo_count--;
+    }
+    join->undo[join->undo_count++] = line_number;
+  } else if (strcmp(line, "CLEAR_PREVIOUS") == 0) {
+    if (join->undo_count == 0 || join->file->cleared_count == RESULTS_MAX_CLEARED) {
+      SERIAL_WARNING("Can't apply CLEAR_PREVIOUS at line %u of %s", line_number, join->file->filename);
+      return;
+    }
+    join->file->cleared[join->file->cleared_count++] = join->undo[--join->undo_count];
+  }
+}
+
+// The bib's place in the chunk. A new bib is added (in bib order) if there is room, or if it
+// is lower than the highest bib in the chunk, which is then left for the next chunk.
+// return NULL if the bib is left for the next chunk
+ResultsEntry *chunk_entry(int bib) {
+  int low = 0;
+  int high = join->entry_count;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (join->entries[middle].bib < bib) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low < join->entry_count && join->entries[low].bib == bib) {
+    return &join->entries[low];
+  }
+  if (join->entry_count == RESULTS_CHUNK_RACERS) {
+    if (low == join->entry_count) {
+      return NULL;
+    }
+    join->entry_count--;
+  }
+  memmove(&join->entries[low + 1], &join->entries[low], sizeof(ResultsEntry) * (join->entry_count - low));
+  join->entry_count++;
+  memset(&join->entries[low], 0, sizeof(ResultsEntry));
+  join->entries[low].bib = bib;
+  return &join->entries[low];
+}
+
+// Store the (latest) time of each bib in the chunk
+// (a bib which is dropped from the chunk is never added again, in the same pass,
+// as only lower bibs are added after that, so its times aren't lost)
+void join_line(char *line) {
+  int bib;
+  TimeResult data;
+  bool fault;
+  uint16_t line_number = join->line_number++;
+  if (!parse_race_line(line, &bib, &data, &fault) || is_cleared(join->file, line_number) ||
+      bib <= join->last_bib || bib < 0) {
+    return;
+  }
+  ResultsEntry *entry = chunk_entry(bib);
+  if (entry == NULL) {
+    return;
+  }
+  if (join->finish) {
+    entry->finish_ms = race_millis(&data);
+    entry->finish_us = data.microsecond;
+    entry->flags |= RESULT_FINISHED;
+  } else {
+    entry->start_ms = race_millis(&data);
+    entry->start_us = data.microsecond;
+    entry->flags = (entry->flags & ~RESULT_FAULT) | RESULT_STARTED | (fault ? RESULT_FAULT : 0);
+  }
+}
+
+bool read_results_file(int file_number, sd_line_handler handler) {
+  join->file = &join->files[file_number];
+  join->finish = file_number == 1;
+  join->line_number = 0;
+  join->undo_count = 0;
+  return sd.readLines(join->file->filename, handler);
+}
+
+// Write the results of the current chunk
+// return the number of lines written
+long write_results_chunk(const char *filename) {
+  char line[RESULTS_LINE_LENGTH];
+  long count = 0;
+  for (int i = 0; i < join->entry_count; i++) {
+    ResultsEntry *entry = &join->entries[i];
+    uint8_t flags = entry->flags;
+    int bib = entry->bib;
+    bool fault = flags & RESULT_FAULT;
+    if (!(flags & RESULT_STARTED)) {
+      snprintf(line, sizeof(line), "%d,DNS,%d", bib, fault);
+    } else if (!(flags & RESULT_FINISHED)) {
+      snprintf(line, sizeof(line), "%d,DNF,%d", bib, fault);
+    } else {
+      int64_t elapsed = ((int64_t)entry->finish_ms - entry->start_ms) * 1000 +
+        entry->finish_us - entry->start_us;
+      // the start and finish timers may count from different race days
+      while (elapsed > RESULTS_HALF_DAY_MICROS) {
+        elapsed -= 2 * RESULTS_HALF_DAY_MICROS;
+      }
+      while (elapsed < -RESULTS_HALF_DAY_MICROS) {
+        elapsed += 2 * RESULTS_HALF_DAY_MICROS;
+      }
+      if (fault) {
+        elapsed += (int64_t)RESULTS_FAULT_PENALTY_SECONDS * 1000000;
+      }
+      if (elapsed < 0) {
+        snprintf(line, sizeof(line), "%d,ERR,%d", bib, fault);
+      } else {
+        // printf on this board doesn't do 64-bit numbers
+        snprintf(line, sizeof(line), "%d,%lu.%06lu,%d", bib,
+          (unsigned long)(elapsed / 1000000), (unsigned long)(elapsed % 1000000), fault);
+      }
+    }
+    sd.writeFile(filename, line, false);
+    count++;
+  }
+  return count;
+}
+
+// Compute the results of the configured race (see race_results.h)
+// return the number of racers, or -1 if the start or finish file can't be read
+long compute_race_results() {
+  ResultsJoin state;
+  join = &state;
+  config.buildFilename(state.files[0].filename, RESULTS_FILENAME_LENGTH, "Start");
+  config.buildFilename(state.files[1].filename, RESULTS_FILENAME_LENGTH, "Finish");
+  char filename[RESULTS_FILENAME_LENGTH];
+  config.buildFilename(filename, RESULTS_FILENAME_LENGTH, "Results");
+
+  unsigned long start_time = millis();
+  for (int i = 0; i < 2; i++) {
+    state.files[i].cleared_count = 0;
+    if (!read_results_file(i, &find_cleared_line)) {
+      SERIAL_ERROR("Can't read %s", state.files[i].filename);
+      join = NULL;
+      return -1;
+    }
+  }
+
+  sd.clearFile(filename);
+  long count = 0;
+  int chunks = 0;
+  state.last_bib = -1;
+  do {
+    state.entry_count = 0;
+    read_results_file(0, &join_line);
+    read_results_file(1, &join_line);
+    count += write_results_chunk(filename);
+    chunks++;
+    if (state.entry_count > 0) {
+      state.last_bib = state.entries[state.entry_count - 1].bib;
+    }
+  } while (state.entry_count == RESULTS_CHUNK_RACERS);
+  sd.drainQueue();
+  sd.sync();
+  char message[80];
+  snprintf(message, sizeof(message), "Results: %ld racers, %d chunks, in ms: %lu", count, chunks, millis() - start_time);
+  SERIAL_INFO("%s", message);
+  log(LOG_INFO, message);
+  join = NULL;
+  return count;
+}
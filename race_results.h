@@ -0,0 +1,27 @@
+#ifndef RACE_RESULTS_H
+#define RACE_RESULTS_H
+#include <Arduino.h>
+
+// Joins the start line and finish line files of the configured race (copied onto one SD card),
+// and writes the time of each racer to race_..._Results_N.txt, in bib order:
+//   bib,elapsed seconds.microseconds (including any penalty),fault
+// elapsed is DNS if there is no start time, DNF if there is no finish time
+//
+// RAM is bounded: the racers are processed RESULTS_CHUNK_RACERS at a time (in bib order),
+// reading both files once for each chunk. Only the bibs which are used take a place in a
+// chunk, so e.g. 300 racers take 10 chunks, whatever their bib numbers are.
+// Start and finish times more than 12 hours apart are taken to be counted from different
+// race days (see race_minute), so a day is added or taken away.
+
+// Each racer in the chunk takes 16 bytes of stack (ResultsJoin is about 900 bytes in all)
+#define RESULTS_CHUNK_RACERS 32
+// Added to the time of a racer who started early (fault), change to suit the event's rules
+#define RESULTS_FAULT_PENALTY_SECONDS 10
+// CLEAR_PREVIOUS lines can cancel up to this many results in a row
+#define RESULTS_UNDO_DEPTH 16
+// Number of CLEAR_PREVIOUS lines which are handled in each file
+#define RESULTS_MAX_CLEARED 64
+
+long compute_race_results();
+
+#endif
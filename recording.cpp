@@ -3,23 +3,31 @@
 #include "uni_sd.h"
 #include "recording.h"
 #include "uni_config.h"
+#include "uni_gps.h"
+#include "journal.h"
+#include "result_record.h"
+#include "modes.h"
+#include "uni_buzzer.h"
 
 extern UniDisplay display;
+extern UniBuzzer buzzer;
 extern UniKeypad keypad;
 extern UniSd sd;
 extern UniConfig config;
+extern UniGps gps;
 
 int _racer_number = 0;
+// Ring buffer of the most recent results, the newest is just before recent_head
 TimeResult recentResult[RECENT_RESULT_COUNT];
 int recentRacer[RECENT_RESULT_COUNT];
+int recent_head = 0;
+int recent_count = 0;
 
 // Add a new digit to the current racer number
 void store_racer_number() {
-  Serial.println("Storing Racer number");
   char last_key_pressed = keypad.lastKeyPressed();
   _racer_number = (_racer_number * 10) + keypad.intFromChar(last_key_pressed);
-  Serial.print("Racer #: ");
-  Serial.println(_racer_number);
+  SERIAL_DEBUG("Racer #: %d", _racer_number);
   display.showNumber(_racer_number);
 }
 
@@ -27,7 +35,7 @@ void store_racer_number() {
 void clear_racer_number() {
   _racer_number = 0;
   display.clear();
-  log("Clear Racer Number");
+  log(LOG_DEBUG, "Clear Racer Number");
 }
 
 int racer_number() {
@@ -48,50 +56,305 @@ bool maximum_digits_racer_number() {
 
 // **((((((((( NEW FILE )))))))))))))))))
 
-bool print_racer_data_to_sd(int racer_number, TimeResult data, bool fault) {
+// Midnight (UTC) of the race day: the date of the race's first result.
+// The first result is in the journal, so this is the same after a power cut
+// (even if the timer is switched on again the next day), see replay_journal
+unsigned long race_day_start = 0;
+
+// Minutes since midnight of the race day,
+// so a race which runs past midnight keeps increasing (1440 + ...)
+unsigned long race_minute(TimeResult *data) {
+  unsigned long seconds = data->epoch_micros / MICROS_PER_SECOND;
+  if (race_day_start == 0) {
+    race_day_start = epoch_day_start(seconds);
+  }
+  if (race_day_start > seconds) {
+    return (seconds - epoch_day_start(seconds)) / 60;
+  }
+  return (seconds - race_day_start) / 60;
+}
+
 #define FILENAME_LENGTH 35
-  char filename[FILENAME_LENGTH];
-  char full_string[FILENAME_LENGTH];
+// Format a line of the race file
+void format_race_line(char *full_string, int racer_number, TimeResult *data, bool fault) {
   char data_string[FILENAME_LENGTH];
-  snprintf(data_string, FILENAME_LENGTH, "%02d,%02d,%03d", (data.hour * 60) + data.minute, data.second, data.millisecond);
-  Serial.println("data_string");
-  Serial.println(data_string);
-  Serial.println("racer_number");
-  Serial.println(racer_number);
+  snprintf(data_string, FILENAME_LENGTH, "%02lu,%02d,%03d", race_minute(data), data->second, data->millisecond);
+  // microseconds are appended as the last column, so that older readers still
+  // find the penalty in the same position
   if (fault) {
-    snprintf(full_string, FILENAME_LENGTH, "%d,,%s,1", racer_number, data_string);
+    snprintf(full_string, FILENAME_LENGTH, "%d,,%s,1,%03d", racer_number, data_string, data->microsecond);
   } else {
-    snprintf(full_string, FILENAME_LENGTH, "%d,,%s,0", racer_number, data_string);
+    snprintf(full_string, FILENAME_LENGTH, "%d,,%s,0,%03d", racer_number, data_string, data->microsecond);
   }
-  log(full_string);
+}
+
+// Store result for review on the system as desired
+void store_recent_result(int racer_number, TimeResult *data) {
+  memcpy(&recentResult[recent_head], data, sizeof(TimeResult));
+  recentRacer[recent_head] = racer_number;
+  recent_head = (recent_head + 1) % RECENT_RESULT_COUNT;
+  if (recent_count < RECENT_RESULT_COUNT) {
+    recent_count++;
+  }
+}
+
+void clear_recent_results() {
+  memset(recentResult, 0, sizeof(recentResult));
+  memset(recentRacer, 0, sizeof(recentRacer));
+  recent_head = 0;
+  recent_count = 0;
+}
+
+// The race filename, with another extension (e.g. ".bin")
+void race_filename_with_extension(char *filename, int max_length, const char *new_extension) {
+  strncpy(filename, config.filename(), max_length - 1);
+  filename[max_length - 1] = '\0';
+  char *extension = strrchr(filename, '.');
+  if (extension != NULL && strlen(extension) == 4) {
+    strcpy(extension, new_extension);
+  }
+}
 
-  // Store result for review on the system as desired
-  for (int i = RECENT_RESULT_COUNT; i > 0; i--) {
-    // copy result 8 to result 9,
-    // copy result 7 to result 8, etc.
-    memcpy(&recentResult[i], &recentResult[i - 1], sizeof(TimeResult));
-    recentRacer[i] = recentRacer[i - 1];
+#ifdef BINARY_RESULTS
+uint32_t binary_sequence = 0;
+
+// The race filename, with .bin instead of .txt
+void binary_filename(char *filename, int max_length) {
+  race_filename_with_extension(filename, max_length, ".bin");
+}
+#endif
+
+// The race index (.idx) has the position of each result line in the race file (uint32_t each),
+// so that any result can be read without reading the whole race file (see race_history)
+// It is rebuilt from the race file when a race is resumed (see rebuild_race_index)
+unsigned long race_index_entries = 0;
+uint32_t race_file_bytes = 0; // including queued lines
+
+void index_filename(char *filename, int max_length) {
+  race_filename_with_extension(filename, max_length, ".idx");
+}
+
+// Add the position of the next race file line to the index
+void index_race_line() {
+  char filename[FILENAME_LENGTH];
+  index_filename(filename, FILENAME_LENGTH);
+  sd.queueBinary(filename, &race_file_bytes, sizeof(race_file_bytes));
+  race_index_entries++;
+}
+
+// A result line (e.g. "12,,603,45,123,0,456"), from the race file (see format_race_line)
+// The hour is counted from midnight of the race day, so it may be over 23 (see race_minute)
+// return false for other lines (e.g. CLEAR_PREVIOUS)
+bool parse_race_line(char *line, int *racer_number, TimeResult *data, bool *fault) {
+  unsigned long minute;
+  int second, millisecond, fault_column, microsecond = 0;
+  if (sscanf(line, "%d,,%lu,%d,%d,%d,%d", racer_number, &minute, &second, &millisecond, &fault_column, &microsecond) < 5) {
+    return false;
   }
-  // store result in slot 0
-  memcpy(&recentResult[0], &data, sizeof(TimeResult));
-  recentRacer[0] = racer_number;
+  memset(data, 0, sizeof(TimeResult));
+  *fault = fault_column == 1;
+  data->hour = minute / 60;
+  data->minute = minute % 60;
+  data->second = second;
+  data->millisecond = millisecond;
+  data->microsecond = microsecond;
+  return true;
+}
+
+// Number of results which can be browsed
+unsigned long race_history_count() {
+  return race_index_entries > (unsigned long)recent_count ? race_index_entries : recent_count;
+}
 
+// Get a result from this race, age 0 is the most recent
+// The most recent are in RAM, older results are read from the race file, using the index
+// return false if there is no such result
+bool race_history(unsigned long age, int *racer_number, TimeResult *data) {
+  if (age < (unsigned long)recent_count) {
+    int slot = (recent_head + RECENT_RESULT_COUNT - 1 - age) % RECENT_RESULT_COUNT;
+    *racer_number = recentRacer[slot];
+    memcpy(data, &recentResult[slot], sizeof(TimeResult));
+    return true;
+  }
+  if (age >= race_index_entries) {
+    return false;
+  }
+  char filename[FILENAME_LENGTH];
+  uint32_t position;
+  index_filename(filename, FILENAME_LENGTH);
+  if (sd.readAt(filename, (race_index_entries - 1 - age) * sizeof(position), &position, sizeof(position)) != sizeof(position)) {
+    return false;
+  }
+  char line[FILENAME_LENGTH];
+  int length = sd.readAt(config.filename(), position, line, FILENAME_LENGTH - 1);
+  if (length <= 0) {
+    return false;
+  }
+  line[length] = '\0';
+  bool fault;
+  return parse_race_line(line, racer_number, data, &fault);
+}
+
+// Write a binary record, in the background (if BINARY_RESULTS is enabled)
+void write_binary_record(uint8_t type, int racer_number, TimeResult *data, bool fault) {
+#ifdef BINARY_RESULTS
+  char filename[FILENAME_LENGTH];
+  binary_filename(filename, FILENAME_LENGTH);
+  ResultRecord record;
+  memset(&record, 0, sizeof(record));
+  record.type = type;
+  record.flags = (fault ? RESULT_FLAG_FAULT : 0) | (gps.holdover() ? RESULT_FLAG_HOLDOVER : 0);
+  record.sequence = ++binary_sequence;
+  record.epoch_micros = data->epoch_micros;
+  record.error_micros = data->error_micros;
+  record.racer_number = racer_number;
+  result_record_seal(&record);
+  sd.queueBinary(filename, &record, sizeof(record));
+#else
+  (void)type;
+  (void)racer_number;
+  (void)data;
+  (void)fault;
+#endif
+}
+
+// Number of lines in the race file (including queued lines), each journal record says which line it was written to,
+// so that the replay knows which lines are missing (see replay_journal)
+unsigned long race_file_lines = 0;
+
+// One bit for each racer number which has a result in the race file (see duplicate_racer_number)
+#define RACER_NUMBER_COUNT 10000
+uint8_t racers_seen[RACER_NUMBER_COUNT / 8];
+
+// The most recent results, which CLEAR_PREVIOUS cancels, the newest last
+// (as in race_results.cpp, older results can't be cancelled)
+#define RACERS_SEEN_UNDO_DEPTH 16
+typedef struct {
+  int16_t racer_number;
+  bool seen_before; // the racer already had a result, so keeps their bit when this is cancelled
+} RacerSeenUndo;
+RacerSeenUndo racers_seen_undo[RACERS_SEEN_UNDO_DEPTH];
+uint8_t racers_seen_undo_count = 0;
+
+bool racer_seen(int racer_number) {
+  return racers_seen[racer_number / 8] & (1 << (racer_number % 8));
+}
+
+void mark_racer_seen(int racer_number) {
+  if (racer_number < 0 || racer_number >= RACER_NUMBER_COUNT) {
+    return;
+  }
+  if (racers_seen_undo_count == RACERS_SEEN_UNDO_DEPTH) {
+    memmove(&racers_seen_undo[0], &racers_seen_undo[1], sizeof(racers_seen_undo[0]) * (RACERS_SEEN_UNDO_DEPTH - 1));
+    racers_seen_undo_count--;
+  }
+  RacerSeenUndo *undo = &racers_seen_undo[racers_seen_undo_count++];
+  undo->racer_number = racer_number;
+  undo->seen_before = racer_seen(racer_number);
+  racers_seen[racer_number / 8] |= 1 << (racer_number % 8);
+}
+
+// CLEAR_PREVIOUS, the last result doesn't count
+void unmark_last_racer_seen() {
+  if (racers_seen_undo_count == 0) {
+    SERIAL_WARNING("CLEAR_PREVIOUS of an older result, duplicates may be reported");
+    return;
+  }
+  RacerSeenUndo *undo = &racers_seen_undo[--racers_seen_undo_count];
+  if (!undo->seen_before) {
+    racers_seen[undo->racer_number / 8] &= ~(1 << (undo->racer_number % 8));
+  }
+}
+
+// Does this racer number already have a result in the race file?
+bool duplicate_racer_number(int racer_number) {
+  if (racer_number < 0 || racer_number >= RACER_NUMBER_COUNT) {
+    return false;
+  }
+  return racer_seen(racer_number);
+}
+
+// dUP is shown for this long, without blocking, so that crossings are still timed
+#define DUPLICATE_WARNING_MS 1000
+unsigned long duplicate_warning_start = 0;
+bool duplicate_warning_shown = false;
+
+// Show dUP, the caller shows its own display again when duplicate_warning_ended()
+void show_duplicate_warning() {
+  log(LOG_WARNING, "DUPLICATE RACER NUMBER");
+  display.duplicate();
+  buzzer.warning();
+  duplicate_warning_start = millis();
+  duplicate_warning_shown = true;
+}
+
+bool duplicate_warning_showing() {
+  return duplicate_warning_shown;
+}
+
+// Has dUP been shown for long enough? (true once)
+bool duplicate_warning_ended() {
+  if (!duplicate_warning_shown || millis() - duplicate_warning_start < DUPLICATE_WARNING_MS) {
+    return false;
+  }
+  duplicate_warning_shown = false;
+  return true;
+}
+
+// Something else is being shown instead
+void cancel_duplicate_warning() {
+  duplicate_warning_shown = false;
+}
+
+// Count a race file line, which was just written (or queued)
+void count_race_line(int length) {
+  race_file_lines++;
+  race_file_bytes += length + 2; // line ending
+}
+
+bool print_racer_data_to_sd(int racer_number, TimeResult data, bool fault) {
+  char filename[FILENAME_LENGTH];
+  char full_string[FILENAME_LENGTH];
+  format_race_line(full_string, racer_number, &data, fault);
+  SERIAL_INFO("Result: %s", full_string);
+
+  // the journal is written first, so that the result can be recovered after a power cut
+  JournalRecord record;
+  record.type = JOURNAL_RESULT;
+  record.racer_number = racer_number;
+  record.epoch_micros = data.epoch_micros;
+  record.error_micros = data.error_micros;
+  record.fault = fault;
+  record.line = race_file_lines;
+  bool journaled = journal_append(&record);
+  log(LOG_INFO, full_string);
+  write_binary_record(RESULT_RECORD_RESULT, racer_number, &data, fault);
+
+  store_recent_result(racer_number, &data);
+
+  // written in the background by sd.loop(), errors are shown by report_sd_errors()
   strncpy(filename, config.filename(), FILENAME_LENGTH);
-  if (sd.writeFile(filename, full_string)) {
+  index_race_line();
+  mark_racer_seen(racer_number);
+  bool queued = sd.queueWrite(filename, full_string);
+  count_race_line(strlen(full_string));
+  if (journaled && queued) {
     return true;
   } else {
     // Error writing to SD
-    Serial.println("Error writing to SD");
+    SERIAL_ERROR("Error writing to SD");
     display.sd();
     return false;
   }
 }
 
-void print_data_to_log(TimeResult data, bool fault) {
-  #define FILENAME_LENGTH 35
-  char data_string[FILENAME_LENGTH];
-  snprintf(data_string, FILENAME_LENGTH, "sensor: %2d,%02d,%02d,%03d,%d", data.hour, data.minute, data.second, data.millisecond, fault);
-  log(data_string);
+void print_data_to_log(TimeResult data, bool fault, uint8_t level) {
+  #define SENSOR_LINE_LENGTH 50
+  char data_string[SENSOR_LINE_LENGTH];
+  // the last column is the error bound of the timestamp, in microseconds
+  snprintf(data_string, SENSOR_LINE_LENGTH, "sensor: %2d,%02d,%02d,%03d,%d,%03d,%lu", data.hour, data.minute, data.second, data.millisecond, fault, data.microsecond, data.error_micros);
+  log(level, data_string);
+  write_binary_record(RESULT_RECORD_EVENT, RESULT_EVENT_SENSOR, &data, fault);
 }
 
 void clear_previous_entry() {
@@ -102,12 +365,256 @@ void clear_previous_entry() {
   strncpy(filename, config.filename(), MAX_FILENAME);
 
   snprintf(message, MAX_MESSAGE, "CLEAR_PREVIOUS");
-  Serial.println("Clear previous entry");
-  sd.writeFile(filename, message);
-  log("Clear Previous entry");
+  SERIAL_INFO("Clear previous entry");
+  JournalRecord record;
+  memset(&record, 0, sizeof(record));
+  record.type = JOURNAL_CLEAR_PREVIOUS;
+  record.line = race_file_lines;
+  journal_append(&record);
+  sd.queueWrite(filename, message);
+  count_race_line(strlen(message));
+  unmark_last_racer_seen();
+  TimeResult now;
+  currentTime(&now);
+  write_binary_record(RESULT_RECORD_CLEAR_PREVIOUS, 0, &now, false);
+  log(LOG_INFO, "Clear Previous entry");
+}
+
+uint32_t indexing_position;
+
+void index_line(char *line) {
+  int racer_number;
+  TimeResult data;
+  bool fault;
+  if (parse_race_line(line, &racer_number, &data, &fault)) {
+    char filename[FILENAME_LENGTH];
+    index_filename(filename, FILENAME_LENGTH);
+    // synced once, at the end of the scan
+    sd.queueBinary(filename, &indexing_position, sizeof(indexing_position), false);
+    race_index_entries++;
+    mark_racer_seen(racer_number);
+  } else if (strcmp(line, "CLEAR_PREVIOUS") == 0) {
+    unmark_last_racer_seen();
+  }
+  indexing_position += strlen(line) + 2; // line ending
+}
+
+// Write the index of the race file again, and find the racers who have a result
+// (it may be missing lines after a power cut, or lines restored from the journal)
+void rebuild_race_index() {
+  unsigned long start_time = millis();
+  char filename[FILENAME_LENGTH];
+  index_filename(filename, FILENAME_LENGTH);
+  sd.clearFile(filename);
+  race_index_entries = 0;
+  indexing_position = 0;
+  memset(racers_seen, 0, sizeof(racers_seen));
+  racers_seen_undo_count = 0;
+  sd.readLines(config.filename(), &index_line);
+  sd.drainQueue();
+  sd.sync();
+  race_file_bytes = indexing_position;
+  SERIAL_INFO("Race file scanned, results: %lu in ms: %lu", race_index_entries, millis() - start_time);
+}
+
+// Space which is preallocated for the race file when a race is configured (~1500 results)
+#define RACE_FILE_PREALLOCATE 65536UL
+// The race file is written here, and renamed, when lines are missing from the middle of it
+#define RACE_FILE_REBUILD "/race.tmp"
+
+// While the journal is replayed, the race file is read alongside it, and each journal record is
+// compared with the race file line which it was written to (see replay_race_line)
+unsigned long replay_file_lines = 0; // complete lines in the race file, before the replay
+unsigned long replay_read_lines = 0; // lines read from the race file, the last one is in replay_file_line
+bool replay_line_used = true;        // replay_file_line matched a journal record (or was copied)
+char replay_file_line[SD_LINE_LENGTH];
+unsigned long replay_lost_lines = 0; // journal records which are missing from the middle of the race file
+bool replay_needs_rebuild = false;
+bool replay_rebuilding = false;      // writing the race file again, in journal order (see rebuild_race_file)
+
+void start_race_file_replay(bool rebuilding) {
+  replay_rebuilding = rebuilding;
+  replay_read_lines = 0;
+  replay_line_used = true;
+  replay_lost_lines = 0;
+  sd.openReader(config.filename());
+}
+
+// Add a line to the race file (or to its replacement, when rebuilding)
+void restore_race_line(char *line) {
+  if (sd.writeFile(replay_rebuilding ? RACE_FILE_REBUILD : config.filename(), line, !replay_rebuilding)) {
+    count_race_line(strlen(line));
+  }
+}
+
+// Read the race file up to the given line
+// when rebuilding, lines which no journal record matched are kept (e.g. written without a journal)
+bool read_race_file_to(unsigned long line_number) {
+  while (replay_read_lines <= line_number) {
+    if (!replay_line_used && replay_rebuilding) {
+      restore_race_line(replay_file_line);
+    }
+    replay_line_used = true;
+    if (sd.readLine(replay_file_line, sizeof(replay_file_line)) < 0) {
+      return false;
+    }
+    replay_read_lines++;
+    replay_line_used = false;
+  }
+  return true;
+}
+
+// Is the journal record's line in the race file? if not, restore it
+// A line which is missing from the middle of the race file (e.g. a failed write) means
+// that the race file is rebuilt, so that the lines stay in order (and CLEAR_PREVIOUS still
+// clears the right result).
+void replay_race_line(JournalRecord *record, char *line) {
+  // each missing line moves the later lines up by one
+  unsigned long line_number = record->line >= replay_lost_lines ? record->line - replay_lost_lines : 0;
+  if (line_number < replay_file_lines) {
+    read_race_file_to(line_number);
+    if (replay_read_lines == line_number + 1 && !replay_line_used && strcmp(replay_file_line, line) == 0) {
+      replay_line_used = true;
+      if (replay_rebuilding) {
+        restore_race_line(line);
+      }
+      return;
+    }
+    replay_lost_lines++;
+    if (!replay_rebuilding) {
+      SERIAL_WARNING("Missing from the race file: %s", line);
+      replay_needs_rebuild = true;
+      return;
+    }
+  } else if (replay_rebuilding) {
+    // the rest of the race file comes first
+    read_race_file_to(replay_file_lines);
+  } else if (replay_needs_rebuild) {
+    return;
+  }
+  SERIAL_INFO("Restoring to race file: %s", line);
+  restore_race_line(line);
+}
+
+// The race file line which a journal record was written to
+// return false if the record isn't written to the race file
+bool race_line_from_record(JournalRecord *record, char *line, TimeResult *data) {
+  time_result_from_epoch(data, record->epoch_micros);
+  data->error_micros = record->error_micros;
+  if (record->type == JOURNAL_RESULT) {
+    format_race_line(line, record->racer_number, data, record->fault);
+  } else if (record->type == JOURNAL_CLEAR_PREVIOUS) {
+    snprintf(line, FILENAME_LENGTH, "CLEAR_PREVIOUS");
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void replay_record(JournalRecord *record) {
+  char line[FILENAME_LENGTH];
+  TimeResult data;
+  if (race_line_from_record(record, line, &data)) {
+    replay_race_line(record, line);
+    if (record->type == JOURNAL_RESULT) {
+      store_recent_result(record->racer_number, &data);
+    }
+  }
+  mode6_replay(record);
 }
 
-#define LOG_FILE "log.txt"
-void log(char *message) {
-  sd.writeFile(LOG_FILE, message);
+// Only the race file lines (see rebuild_race_file)
+void rebuild_record(JournalRecord *record) {
+  char line[FILENAME_LENGTH];
+  TimeResult data;
+  if (race_line_from_record(record, line, &data)) {
+    replay_race_line(record, line);
+  }
+}
+
+// Write the race file again, in journal order, with the missing lines in their places
+void rebuild_race_file() {
+  SERIAL_WARNING("Rebuilding the race file, lines missing: %lu", replay_lost_lines);
+  sd.clearFile(RACE_FILE_REBUILD);
+  start_race_file_replay(true);
+  journal_replay(&rebuild_record);
+  // and any lines after the last journal record
+  read_race_file_to(replay_file_lines);
+  sd.closeReader();
+  replay_rebuilding = false;
+  if (sd.replaceFile(RACE_FILE_REBUILD, config.filename())) {
+    sd.preallocate(config.filename(), RACE_FILE_PREALLOCATE);
+  } else {
+    SERIAL_ERROR("Error rebuilding the race file");
+  }
+  long lines = sd.repairFile(config.filename());
+  race_file_lines = lines > 0 ? lines : 0;
+}
+
+// Rebuild the race file, recent results, and mode 6 waiting times from the journal
+// (called when resuming mode 5/6, e.g. after a power cut)
+void replay_journal() {
+  long lines = sd.repairFile(config.filename());
+  replay_file_lines = lines > 0 ? lines : 0;
+  race_file_lines = replay_file_lines;
+  // taken from the first result in the journal (see race_minute)
+  race_day_start = 0;
+  clear_recent_results();
+  mode6_clear_results();
+
+  journal_open(config.filename());
+  replay_needs_rebuild = false;
+  start_race_file_replay(false);
+  journal_replay(&replay_record);
+  sd.closeReader();
+  if (replay_needs_rebuild) {
+    rebuild_race_file();
+  }
+  rebuild_race_index();
+
+#ifdef BINARY_RESULTS
+  // carry on numbering from the last complete record
+  char filename[FILENAME_LENGTH];
+  binary_filename(filename, FILENAME_LENGTH);
+  binary_sequence = sd.fileSize(filename) / sizeof(ResultRecord);
+#endif
+}
+
+// Allocate space for the race file and log in advance, so that appending
+// to them doesn't need to allocate clusters (see UniSd::preallocate)
+void preallocate_race_files() {
+  sd.preallocate(config.filename(), RACE_FILE_PREALLOCATE);
+  sd.preallocate(log_filename(), LOG_SEGMENT_SIZE);
+}
+
+// Set the size of the race file and log to the data in them, so that
+// they can be read normally (see UniSd::finishFile)
+void finish_race_files() {
+  sd.finishFile(config.filename());
+  sd.finishFile(log_filename());
+  sd.printLatency();
+}
+
+// Mode 5/6 is running, so a power cut should resume the race straight away (see fast_resume)
+void mark_race_in_progress(bool in_progress) {
+  if (in_progress) {
+    journal_begin_race(config.filename());
+  } else {
+    journal_end_race(config.filename());
+  }
+}
+unsigned long reported_sd_queue_full = 0;
+
+// Show errors from the background SD writes (called from the main loop)
+void report_sd_errors() {
+  if (sd.takeWriteError()) {
+    SERIAL_ERROR("Error writing to SD");
+    log(LOG_ERROR, "Error writing to SD");
+    display.sd();
+  }
+  if (sd.queueFullCount() != reported_sd_queue_full) {
+    reported_sd_queue_full = sd.queueFullCount();
+    SERIAL_WARNING("SD queue was full, times: %lu", reported_sd_queue_full);
+    log(LOG_WARNING, "SD queue was full");
+  }
 }
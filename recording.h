@@ -1,6 +1,12 @@
 #pragma once
 
 #include "accurate_timing.h"
+#include "event_log.h"
+#include "serial_log.h"
+
+// Also write each result (and sensor event) as a fixed-size binary record,
+// to a .bin file next to the race file (see result_record.h, and tools/results_to_csv.cpp)
+//#define BINARY_RESULTS
 void store_racer_number();
 void clear_racer_number();
 int racer_number();
@@ -9,13 +15,27 @@ bool maximum_digits_racer_number();
 // ****************
 void build_race_filename(char *filename, const int max_length);
 bool print_racer_data_to_sd(int racer_number, TimeResult data, bool fault = false);
-void print_data_to_log(TimeResult data, bool fault = false);
+void print_data_to_log(TimeResult data, bool fault = false, uint8_t level = LOG_INFO);
 void clear_previous_entry();
-void log(char *message);
+void replay_journal();
+void preallocate_race_files();
+void finish_race_files();
+void mark_race_in_progress(bool in_progress);
+void report_sd_errors();
 
 #include "uni_config.h"
 Config *getConfig();
+// The most recent results are kept in RAM, older ones are read from the SD card (see race_history)
 #define RECENT_RESULT_COUNT 9
-extern TimeResult recentResult[RECENT_RESULT_COUNT];
-extern int recentRacer[RECENT_RESULT_COUNT];
+// Results shown per page when browsing (0 + 1..9)
+#define HISTORY_PAGE_SIZE 9
+bool duplicate_racer_number(int racer_number);
+void show_duplicate_warning();
+bool duplicate_warning_showing();
+bool duplicate_warning_ended();
+void cancel_duplicate_warning();
+bool parse_race_line(char *line, int *racer_number, TimeResult *data, bool *fault);
+void clear_recent_results();
+bool race_history(unsigned long age, int *racer_number, TimeResult *data);
+unsigned long race_history_count();
 // ****************
@@ -0,0 +1,46 @@
+#ifndef RESULT_RECORD_H
+#define RESULT_RECORD_H
+#include <stdint.h>
+#include "crc16.h"
+
+// Fixed-size binary record, written next to the race file (.txt -> .bin) when
+// BINARY_RESULTS is defined (see recording.h).
+// Every record starts with RESULT_RECORD_MAGIC and ends with a CRC, so a reader
+// can skip a torn record, and find the next one.
+// Little-endian, the same layout on the Teensy and on a PC (see tools/results_to_csv.cpp)
+
+#define RESULT_RECORD_MAGIC 0x5255 // "UR"
+
+#define RESULT_RECORD_RESULT 'R'
+#define RESULT_RECORD_CLEAR_PREVIOUS 'C'
+#define RESULT_RECORD_EVENT 'E' // racer_number is the event code
+
+#define RESULT_EVENT_SENSOR 1
+
+#define RESULT_FLAG_FAULT 0x01    // early start (penalty)
+#define RESULT_FLAG_HOLDOVER 0x02 // the GPS PPS was lost, timed by the local clock
+
+typedef struct {
+  uint16_t magic;
+  uint8_t type;
+  uint8_t flags;
+  uint32_t sequence;
+  int64_t epoch_micros; // microseconds since 1970 (UTC)
+  uint32_t error_micros;
+  uint16_t racer_number;
+  uint16_t crc; // CRC-16 of everything before it
+} ResultRecord;
+
+static_assert(sizeof(ResultRecord) == 24, "ResultRecord must have the same layout on the Teensy and the PC");
+
+static inline void result_record_seal(ResultRecord *record) {
+  record->magic = RESULT_RECORD_MAGIC;
+  record->crc = crc16_ccitt(record, sizeof(ResultRecord) - sizeof(uint16_t));
+}
+
+static inline bool result_record_valid(const ResultRecord *record) {
+  return record->magic == RESULT_RECORD_MAGIC &&
+    record->crc == crc16_ccitt(record, sizeof(ResultRecord) - sizeof(uint16_t));
+}
+
+#endif
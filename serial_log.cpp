@@ -0,0 +1,58 @@
+// - Buffered serial debug output, see serial_log.h
+#include <stdarg.h>
+#include "serial_log.h"
+
+char _serial_log_buffer[SERIAL_LOG_BUFFER_SIZE];
+uint16_t _serial_log_head = 0;
+uint16_t _serial_log_used = 0;
+unsigned long _serial_log_dropped = 0;
+
+// Format the message into the buffer (or drop it, if there isn't space)
+void serial_log(const __FlashStringHelper *format, ...) {
+  char line[SERIAL_LOG_LINE_LENGTH];
+  va_list args;
+  va_start(args, format);
+  // flash is in the normal address space on ARM, so the format can be used directly
+  int length = vsnprintf(line, sizeof(line) - 2, (const char *)format, args);
+  va_end(args);
+  if (length < 0) {
+    return;
+  }
+  if (length > (int)sizeof(line) - 3) {
+    length = sizeof(line) - 3;
+  }
+  line[length++] = '\r';
+  line[length++] = '\n';
+
+  if (_serial_log_used + length > SERIAL_LOG_BUFFER_SIZE) {
+    _serial_log_dropped++;
+    return;
+  }
+  for (int i = 0; i < length; i++) {
+    _serial_log_buffer[(_serial_log_head + _serial_log_used) % SERIAL_LOG_BUFFER_SIZE] = line[i];
+    _serial_log_used++;
+  }
+}
+
+// Write as much of the buffer as the serial port will take without waiting
+void serial_log_flush() {
+  int space = Serial.availableForWrite();
+  while (_serial_log_used > 0 && space > 0) {
+    uint16_t chunk = SERIAL_LOG_BUFFER_SIZE - _serial_log_head;
+    if (chunk > _serial_log_used) {
+      chunk = _serial_log_used;
+    }
+    if (chunk > space) {
+      chunk = space;
+    }
+    Serial.write((const uint8_t *)&_serial_log_buffer[_serial_log_head], chunk);
+    _serial_log_head = (_serial_log_head + chunk) % SERIAL_LOG_BUFFER_SIZE;
+    _serial_log_used -= chunk;
+    space -= chunk;
+  }
+}
+
+// Number of messages which didn't fit in the buffer
+unsigned long serial_log_dropped() {
+  return _serial_log_dropped;
+}
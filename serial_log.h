@@ -0,0 +1,38 @@
+#ifndef SERIAL_LOG_H
+#define SERIAL_LOG_H
+#include <Arduino.h>
+#include "event_log.h" // for the levels
+
+// Debug output on the USB serial port.
+//
+// SERIAL_DEBUG/INFO/WARNING/ERROR("format %d", value) are printf-style.
+// - messages below SERIAL_COMPILED_LEVEL are removed when compiling
+//   (including the format string, and the arguments)
+// - the format strings stay in flash (F())
+// - the output is buffered, and written from the main loop by serial_log_flush(),
+//   as fast as the host reads it. If the buffer is full (e.g. no-one is
+//   listening), messages are dropped, rather than slowing down the timer.
+
+#ifndef SERIAL_COMPILED_LEVEL
+#define SERIAL_COMPILED_LEVEL LOG_INFO
+#endif
+#define SERIAL_LOG_BUFFER_SIZE 512
+// Longer messages are cut short
+#define SERIAL_LOG_LINE_LENGTH 96
+
+void serial_log(const __FlashStringHelper *format, ...);
+void serial_log_flush();
+unsigned long serial_log_dropped();
+
+#define SERIAL_LOG(level, format, ...) do { \
+    if ((level) >= SERIAL_COMPILED_LEVEL) { \
+      serial_log(F(format), ##__VA_ARGS__); \
+    } \
+  } while (0)
+
+#define SERIAL_DEBUG(format, ...) SERIAL_LOG(LOG_DEBUG, format, ##__VA_ARGS__)
+#define SERIAL_INFO(format, ...) SERIAL_LOG(LOG_INFO, format, ##__VA_ARGS__)
+#define SERIAL_WARNING(format, ...) SERIAL_LOG(LOG_WARNING, format, ##__VA_ARGS__)
+#define SERIAL_ERROR(format, ...) SERIAL_LOG(LOG_ERROR, format, ##__VA_ARGS__)
+
+#endif
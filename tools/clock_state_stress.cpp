@@ -0,0 +1,171 @@
+// Checks that ClockStateBuffer (clock_state.cpp) never returns a torn ClockState,
+// by writing it from one thread while other threads read it, on a PC.
+//
+//   g++ -O2 -std=gnu++11 -pthread -I tools/host -I . -include Arduino.h -o clock_state_stress tools/clock_state_stress.cpp
+//   ./clock_state_stress [SECONDS] [READERS]
+//
+// Each state that is written has every field computed from one counter, so a reader can tell
+// if what it read came from more than one write (torn), or from an older write than the one it
+// read before (went backwards).
+// On the timer the writer and the reader interrupt each other on one core. Here they are threads,
+// each pinned to its own core (the writer to the first, the readers spread over the others),
+// so that they really run in parallel, which finds more interleavings than one core does.
+// It needs at least 2 cores. The same test is also run on a plain ClockState,
+// shared without ClockStateBuffer, to show that the test does find torn reads.
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+#include "clock_state.cpp"
+
+typedef struct {
+  unsigned long reads;
+  unsigned long torn;
+  unsigned long backwards;
+} ReaderCounts;
+
+ClockStateBuffer buffer;
+volatile ClockState plain;
+std::atomic<bool> stop(false);
+bool use_buffer = true;
+
+// The cores this process may run on
+int cpus[CPU_SETSIZE];
+int cpu_count = 0;
+
+void find_cpus() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    return;
+  }
+  for (int i = 0; i < CPU_SETSIZE; i++) {
+    if (CPU_ISSET(i, &set)) {
+      cpus[cpu_count++] = i;
+    }
+  }
+}
+
+// The writer runs on the first core, reader i on one of the others
+bool pin_thread(pthread_t thread, int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+void make_state(ClockState *state, unsigned long n) {
+  state->valid = true;
+  state->pps_micros = n;
+  state->pps_millis = n * 3;
+  state->gps_epoch_seconds = 1500000000UL + n;
+  state->drift_factor = -(int32_t)n;
+  state->uncertainty_factor = (int32_t)(n * 7);
+  state->jitter_micros = n ^ 0x5555;
+}
+
+bool consistent(const ClockState *state) {
+  ClockState expected;
+  make_state(&expected, state->pps_micros);
+  return state->valid &&
+    state->pps_millis == expected.pps_millis &&
+    state->gps_epoch_seconds == expected.gps_epoch_seconds &&
+    state->drift_factor == expected.drift_factor &&
+    state->uncertainty_factor == expected.uncertainty_factor &&
+    state->jitter_micros == expected.jitter_micros;
+}
+
+void *writer(void *) {
+  ClockState state;
+  for (unsigned long n = 1; !stop; n++) {
+    make_state(&state, n);
+    if (use_buffer) {
+      buffer.write(&state);
+    } else {
+      memcpy((void *)&plain, &state, sizeof(state));
+    }
+  }
+  return NULL;
+}
+
+void *reader(void *arg) {
+  ReaderCounts *counts = (ReaderCounts *)arg;
+  unsigned long last = 0;
+  ClockState state;
+  while (!stop) {
+    if (use_buffer) {
+      buffer.read(&state);
+    } else {
+      memcpy(&state, (const void *)&plain, sizeof(state));
+    }
+    counts->reads++;
+    if (!state.valid) {
+      continue; // nothing written yet
+    }
+    if (!consistent(&state)) {
+      counts->torn++;
+    } else if (state.pps_micros < last) {
+      counts->backwards++;
+    } else {
+      last = state.pps_micros;
+    }
+  }
+  return NULL;
+}
+
+// return the number of bad reads
+unsigned long run(bool buffered, int seconds, int readers) {
+  use_buffer = buffered;
+  stop = false;
+
+  pthread_t writer_thread;
+  pthread_t reader_threads[readers];
+  ReaderCounts counts[readers];
+  memset(counts, 0, sizeof(counts));
+  pthread_create(&writer_thread, NULL, writer, NULL);
+  bool pinned = pin_thread(writer_thread, cpus[0]);
+  for (int i = 0; i < readers; i++) {
+    pthread_create(&reader_threads[i], NULL, reader, &counts[i]);
+    pinned = pin_thread(reader_threads[i], cpus[1 + i % (cpu_count - 1)]) && pinned;
+  }
+  if (!pinned) {
+    printf("Couldn't pin the threads to their cores\n");
+  }
+  sleep(seconds);
+  stop = true;
+  pthread_join(writer_thread, NULL);
+  ReaderCounts total = { 0, 0, 0 };
+  for (int i = 0; i < readers; i++) {
+    pthread_join(reader_threads[i], NULL);
+    total.reads += counts[i].reads;
+    total.torn += counts[i].torn;
+    total.backwards += counts[i].backwards;
+  }
+  ClockState last;
+  buffer.read(&last);
+  printf("%s: %lu writes, %lu reads, %lu torn, %lu went backwards\n",
+    buffered ? "ClockStateBuffer" : "plain ClockState (control)",
+    buffered ? last.pps_micros : plain.pps_micros, total.reads, total.torn, total.backwards);
+  return total.torn + total.backwards;
+}
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 5;
+  int readers = argc > 2 ? atoi(argv[2]) : 2;
+  if (seconds < 1 || readers < 1) {
+    printf("usage: clock_state_stress [SECONDS] [READERS]\n");
+    return 1;
+  }
+  find_cpus();
+  printf("%d CPUs\n", cpu_count);
+  if (cpu_count < 2) {
+    printf("The writer and the readers must run on different cores, at least 2 are needed\n");
+    return 2;
+  }
+  unsigned long bad = run(true, seconds, readers);
+  unsigned long control = run(false, seconds, readers);
+  if (control == 0) {
+    printf("The control found no torn reads, run for longer to trust the result\n");
+  }
+  return bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+// Checks UniGps::configureReceiver() against fake receivers which behave differently
+// (tools/host/fake_gps_receiver.h), on a PC.
+//
+//   g++ -O2 -std=gnu++11 -I tools/host -I . -include Arduino.h -o gps_configure_test tools/gps_configure_test.cpp
+//   ./gps_configure_test
+//
+// For each receiver: the timer is set up (as at power-on), then runs for a few seconds.
+// It must end up at the same baud rate as the receiver (at the fast rate, if the receiver can
+// do it), say whether the receiver accepted the configuration, and get a GPS lock.
+// setup() mustn't wait for the receiver (the configuration is finished by readData()).
+#include "uni_gps.cpp"
+#include "diagnostics.cpp"
+#include "nmea_parser.cpp"
+#include "clock_model.cpp"
+#include "clock_state.cpp"
+#include "epoch_time.cpp"
+#include "serial_log.cpp"
+#include "fake_gps_receiver.h"
+
+#define PPS_PIN 2
+// 2018-06-30 10:00:00 UTC
+#define START_EPOCH_SECONDS 1530352800UL
+#define RUN_SECONDS 5
+#define LOOP_MICROS 200
+// setup() may take this long
+#define MAX_SETUP_MS 10
+
+UniGps gps(PPS_PIN);
+FakeGpsReceiver receiver(&Serial2, PPS_PIN, START_EPOCH_SECONDS);
+
+void poll_receiver() {
+  receiver.poll();
+}
+
+void pps_interrupt(unsigned long now) {
+  gps.ppsReceived(now);
+}
+
+typedef struct {
+  const char *name;
+  unsigned long baud; // of the receiver at power-on
+  bool answers;
+  bool fast_baud;
+  int reject_command;
+  // expected
+  unsigned long expected_baud;
+  bool expected_configured;
+} ReceiverTest;
+
+const ReceiverTest tests[] = {
+  { "MTK3339", 9600, true, true, -1, GPS_FAST_BAUD, true },
+  { "already at the fast baud rate (timer was reset)", GPS_FAST_BAUD, true, true, -1, GPS_FAST_BAUD, true },
+  { "can't change baud rate", 9600, true, false, -1, 9600, true },
+  { "rejects the sentence selection (PMTK314)", 9600, true, true, 314, GPS_FAST_BAUD, false },
+  { "rejects the update rate (PMTK220)", 9600, true, true, 220, GPS_FAST_BAUD, false },
+  { "doesn't know PMTK (not an MTK receiver)", 9600, false, false, -1, 9600, false },
+};
+
+// return true if the test passed
+bool run_test(const ReceiverTest *test) {
+  host_micros = 0;
+  Serial2 = HostSerial(false);
+  Serial2.poll = &poll_receiver;
+  receiver = FakeGpsReceiver(&Serial2, PPS_PIN, START_EPOCH_SECONDS);
+  receiver.baud = test->baud;
+  receiver.answers = test->answers;
+  receiver.fast_baud = test->fast_baud;
+  receiver.reject_command = test->reject_command;
+  gps = UniGps(PPS_PIN);
+
+  gps.setup(&pps_interrupt);
+  unsigned long setup_ms = millis();
+  unsigned long configured_ms = 0;
+  while (millis() < setup_ms + RUN_SECONDS * 1000UL) {
+    receiver.poll();
+    gps.readData();
+    if (configured_ms == 0 && !gps.configuring()) {
+      configured_ms = millis();
+    }
+    host_micros += LOOP_MICROS;
+  }
+
+  bool passed = gps.baud() == test->expected_baud && receiver.baud == gps.baud() &&
+    gps.configured() == test->expected_configured && gps.lock() && setup_ms <= MAX_SETUP_MS &&
+    configured_ms != 0;
+  printf("%s: %s\n", passed ? "PASS" : "FAIL", test->name);
+  printf("  timer at %lu baud, receiver at %lu baud, configured: %s, lock: %s, setup took %lums, configuration %lums\n",
+    gps.baud(), receiver.baud, gps.configured() ? "yes" : "no", gps.lock() ? "yes" : "no", setup_ms,
+    configured_ms);
+  if (!passed) {
+    printf("  expected %lu baud, configured: %s, lock: yes, setup within %dms\n",
+      test->expected_baud, test->expected_configured ? "yes" : "no", MAX_SETUP_MS);
+  }
+  return passed;
+}
+
+int main() {
+  Serial.echo = false; // only show the results
+  int failed = 0;
+  for (unsigned int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    failed += !run_test(&tests[i]);
+  }
+  printf("%d failed\n", failed);
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,11 @@
+// The display's type, so that uni_display.h builds on the host.
+// The host programs define the UniDisplay methods which they need (usually as no-ops).
+#ifndef HOST_ADAFRUIT_LEDBACKPACK_H
+#define HOST_ADAFRUIT_LEDBACKPACK_H
+#include <Arduino.h>
+
+class Adafruit_7segment
+{
+};
+
+#endif
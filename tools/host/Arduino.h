@@ -0,0 +1,186 @@
+// Just enough of the Arduino core to build the timer's code on a PC, for the
+// host programs in tools/ (see tools/race_results_sim.cpp for how they are built).
+//
+// Each host program is one translation unit: it includes the .cpp files which it
+// tests, so the globals below are defined here.
+//
+// Time doesn't pass by itself: micros() and millis() return host_micros, which the
+// program moves on (host_advance_micros), and which delay() moves on.
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 4
+#define FALLING 2
+#define RISING 3
+#define DEC 10
+#define HEX 16
+
+// String literals are already in flash on ARM, F() is only a type
+class __FlashStringHelper;
+#define F(string) (reinterpret_cast<const __FlashStringHelper *>(string))
+
+static unsigned long host_micros = 0;
+// Called by delay(), e.g. so that a fake receiver can answer while the code waits
+static void (*host_delay_hook)(unsigned long ms) = NULL;
+
+inline void host_advance_micros(unsigned long micros_to_add) {
+  host_micros += micros_to_add;
+}
+
+inline unsigned long micros() {
+  return host_micros;
+}
+
+inline unsigned long millis() {
+  return host_micros / 1000;
+}
+
+inline void delay(unsigned long ms) {
+  if (host_delay_hook != NULL) {
+    host_delay_hook(ms);
+  }
+  host_micros += ms * 1000;
+}
+
+inline void delayMicroseconds(unsigned int us) {
+  host_micros += us;
+}
+
+inline void yield() {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// Pins: digitalRead() returns what the program set with host_pin_level
+static uint8_t host_pin_levels[64];
+inline void host_pin_level(int pin, uint8_t level) {
+  host_pin_levels[pin] = level;
+}
+inline void pinMode(int, int) {}
+inline int digitalRead(int pin) {
+  return host_pin_levels[pin];
+}
+inline void digitalWrite(int pin, int level) {
+  host_pin_levels[pin] = level;
+}
+inline void tone(int, unsigned int, unsigned long = 0) {}
+inline void noTone(int) {}
+
+// attachInterrupt() handlers, the program calls them (host_interrupt) to simulate an edge
+static void (*host_interrupts[64])() = { NULL };
+inline int digitalPinToInterrupt(int pin) {
+  return pin;
+}
+inline void attachInterrupt(int interrupt, void (*handler)(), int) {
+  host_interrupts[interrupt] = handler;
+}
+inline void detachInterrupt(int interrupt) {
+  host_interrupts[interrupt] = NULL;
+}
+inline bool host_interrupt(int pin) {
+  if (host_interrupts[pin] == NULL) {
+    return false;
+  }
+  host_interrupts[pin]();
+  return true;
+}
+
+// Checking a serial port takes this long, so that a loop which waits for
+// an answer (until millis() says it has waited long enough) does end
+#define HOST_SERIAL_POLL_MICROS 1
+
+// A serial port. What the code writes is kept in `sent` (and printed, if echo is set),
+// what it reads comes from `received`, which the program fills in
+// (e.g. from `poll`, which is called whenever the code reads or writes).
+class HostSerial
+{
+  public:
+    HostSerial(bool echo_output) : echo(echo_output), baud(0), read_position(0), poll(NULL) {}
+    bool echo;
+    unsigned long baud;
+    std::string sent;
+    std::string received;
+    size_t read_position;
+    void (*poll)();
+
+    void begin(unsigned long new_baud) { baud = new_baud; }
+    void end() {}
+    void flush() {}
+    operator bool() { return true; }
+    int available() {
+      host_micros += HOST_SERIAL_POLL_MICROS;
+      if (poll != NULL) {
+        poll();
+      }
+      return received.size() - read_position;
+    }
+    int availableForWrite() { return 4096; }
+    int peek() { return available() ? (uint8_t)received[read_position] : -1; }
+    int read() {
+      if (received.size() == read_position) {
+        return -1;
+      }
+      int c = (uint8_t)received[read_position++];
+      if (read_position == received.size()) {
+        received.clear();
+        read_position = 0;
+      }
+      return c;
+    }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(char c) { return write((const uint8_t *)&c, 1); }
+    size_t write(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+    size_t write(const uint8_t *data, size_t length) {
+      if (echo) {
+        fwrite(data, 1, length, stdout);
+      } else {
+        sent.append((const char *)data, length);
+        if (poll != NULL) {
+          poll();
+        }
+      }
+      return length;
+    }
+    size_t print(const char *text) { return write(text); }
+    size_t print(const __FlashStringHelper *text) { return write((const char *)text); }
+    size_t print(char c) { return write(c); }
+    size_t print(const std::string &text) { return write(text.c_str()); }
+    size_t print(long value, int base = DEC) { return printNumber(base == HEX ? "%lX" : "%ld", value); }
+    size_t print(int value, int base = DEC) { return print((long)value, base); }
+    size_t print(unsigned long value, int base = DEC) { return printNumber(base == HEX ? "%lX" : "%lu", (long)value); }
+    size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(double value, int digits = 2) {
+      char text[40];
+      snprintf(text, sizeof(text), "%.*f", digits, value);
+      return write(text);
+    }
+    template<typename T> size_t println(T value) { size_t length = print(value); return length + println(); }
+    template<typename T> size_t println(T value, int format) { size_t length = print(value, format); return length + println(); }
+    size_t println() { return write("\r\n"); }
+  private:
+    size_t printNumber(const char *format, long value) {
+      char text[24];
+      snprintf(text, sizeof(text), format, value);
+      return write(text);
+    }
+};
+
+static HostSerial Serial(true);   // USB, printed
+static HostSerial Serial1(false);
+static HostSerial Serial2(false); // the GPS receiver
+
+#endif
@@ -0,0 +1,28 @@
+// The Teensy LC's EEPROM, in memory (see tools/host/Arduino.h)
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+#include <Arduino.h>
+
+#define HOST_EEPROM_SIZE 128
+
+class EEPROMClass
+{
+  public:
+    uint8_t data[HOST_EEPROM_SIZE];
+    template<typename T> T &get(int address, T &value) {
+      memcpy(&value, data + address, sizeof(T));
+      return value;
+    }
+    template<typename T> const T &put(int address, const T &value) {
+      memcpy(data + address, &value, sizeof(T));
+      return value;
+    }
+    uint8_t read(int address) { return data[address]; }
+    void write(int address, uint8_t value) { data[address] = value; }
+    void update(int address, uint8_t value) { data[address] = value; }
+    uint16_t length() { return HOST_EEPROM_SIZE; }
+};
+
+static EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,13 @@
+// The keypad's types, so that uni_keypad.h builds on the host.
+// The host programs define the UniKeypad methods which they need.
+#ifndef HOST_KEYPAD_H
+#define HOST_KEYPAD_H
+#include <Arduino.h>
+
+#define NO_KEY '\0'
+
+class Keypad
+{
+};
+
+#endif
@@ -0,0 +1,4 @@
+// SPI is only used through SdFat, see SdFat.h
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+#endif
@@ -0,0 +1,386 @@
+// An SD card in memory, with the parts of the SdFat 1.x API that the timer uses,
+// for the host programs in tools/.
+//
+// Each operation moves host_micros on by roughly what it takes on the timer (an SPI card
+// on a Teensy LC), so that code which measures itself with micros() gets realistic numbers.
+// These are estimates, not measurements: a block read ~0.4ms, a block write ~0.7ms
+// (1ms for the FAT or a directory block), SD.begin() ~20ms.
+//
+// Files created with createContiguous() keep their data in "disk" blocks, which can
+// also be read and written directly (SD.card()->readBlock etc), as on a real card.
+// Everything else is kept in a string.
+#ifndef HOST_SDFAT_H
+#define HOST_SDFAT_H
+#include <Arduino.h>
+#include <map>
+#include <vector>
+
+#define O_RDONLY 0x00
+#define O_WRITE 0x01
+#define O_RDWR 0x02
+#define O_CREAT 0x10
+#define O_AT_END 0x20
+#define FILE_READ O_RDONLY
+#define FILE_WRITE (O_RDWR | O_CREAT | O_AT_END)
+
+#define HOST_SD_BLOCK_SIZE 512
+#define HOST_SD_BEGIN_MICROS 20000UL
+#define HOST_SD_BLOCK_READ_MICROS 400UL
+#define HOST_SD_BLOCK_WRITE_MICROS 700UL
+#define HOST_SD_METADATA_WRITE_MICROS 1000UL // FAT or directory block
+#define HOST_SD_MULTI_BLOCK_WRITE_MICROS 300UL // each block of writeStart..writeStop
+#define HOST_SD_CLUSTER_BLOCKS 8
+
+typedef struct {
+  std::string data;         // an ordinary file
+  bool contiguous;          // data is in disk blocks first_block..
+  uint32_t first_block;
+  uint32_t block_count;
+  uint32_t size;
+} HostSdFile;
+
+static std::map<std::string, HostSdFile> host_sd_files;
+static std::vector<std::vector<uint8_t> > host_sd_disk;
+static bool host_sd_present = true; // false: every operation fails, as if the card was removed
+
+// Counters, e.g. for benchmarks
+static unsigned long host_sd_block_reads = 0;
+static unsigned long host_sd_block_writes = 0;
+
+inline void host_sd_read_cost(unsigned long blocks = 1) {
+  host_sd_block_reads += blocks;
+  host_advance_micros(blocks * HOST_SD_BLOCK_READ_MICROS);
+}
+
+inline void host_sd_write_cost(unsigned long blocks = 1, unsigned long micros_each = HOST_SD_BLOCK_WRITE_MICROS) {
+  host_sd_block_writes += blocks;
+  host_advance_micros(blocks * micros_each);
+}
+
+inline std::string host_sd_name(const char *filename) {
+  return filename[0] == '/' ? std::string(filename + 1) : std::string(filename);
+}
+
+// Everything in a file (for contiguous files, up to its size)
+inline std::string host_sd_contents(const char *filename) {
+  std::map<std::string, HostSdFile>::iterator found = host_sd_files.find(host_sd_name(filename));
+  if (found == host_sd_files.end()) {
+    return "";
+  }
+  HostSdFile &file = found->second;
+  if (!file.contiguous) {
+    return file.data;
+  }
+  std::string result;
+  for (uint32_t i = 0; i < file.size; i++) {
+    result += (char)host_sd_disk[file.first_block + i / HOST_SD_BLOCK_SIZE][i % HOST_SD_BLOCK_SIZE];
+  }
+  return result;
+}
+
+// Replace a file's contents (as an ordinary file)
+inline void host_sd_set_contents(const char *filename, const std::string &contents) {
+  HostSdFile &file = host_sd_files[host_sd_name(filename)];
+  file.contiguous = false;
+  file.data = contents;
+  file.size = contents.size();
+}
+
+class SdCard
+{
+  public:
+    bool readBlock(uint32_t block, uint8_t *data) {
+      if (!host_sd_present || block >= host_sd_disk.size()) {
+        return false;
+      }
+      host_sd_read_cost();
+      memcpy(data, &host_sd_disk[block][0], HOST_SD_BLOCK_SIZE);
+      return true;
+    }
+    bool writeBlock(uint32_t block, const uint8_t *data) {
+      if (!host_sd_present || block >= host_sd_disk.size()) {
+        return false;
+      }
+      host_sd_write_cost();
+      memcpy(&host_sd_disk[block][0], data, HOST_SD_BLOCK_SIZE);
+      return true;
+    }
+    bool writeStart(uint32_t block, uint32_t) {
+      _next_block = block;
+      return host_sd_present;
+    }
+    bool writeData(const uint8_t *data) {
+      if (!host_sd_present || _next_block >= host_sd_disk.size()) {
+        return false;
+      }
+      host_sd_write_cost(1, HOST_SD_MULTI_BLOCK_WRITE_MICROS);
+      memcpy(&host_sd_disk[_next_block++][0], data, HOST_SD_BLOCK_SIZE);
+      return true;
+    }
+    bool writeStop() {
+      return host_sd_present;
+    }
+  private:
+    uint32_t _next_block;
+};
+
+class File
+{
+  public:
+    File() : _open(false), _writable(false), _dirty(false), _position(0), _synced_size(0) {}
+    operator bool() { return _open; }
+    bool isOpen() { return _open; }
+
+    bool open(const char *filename, uint8_t flags) {
+      _open = false;
+      if (!host_sd_present) {
+        return false;
+      }
+      host_sd_read_cost(); // directory search
+      _name = host_sd_name(filename);
+      if (host_sd_files.find(_name) == host_sd_files.end()) {
+        if (!(flags & O_CREAT)) {
+          return false;
+        }
+        HostSdFile created;
+        created.contiguous = false;
+        created.first_block = 0;
+        created.block_count = 0;
+        created.size = 0;
+        host_sd_files[_name] = created;
+        host_sd_write_cost(1, HOST_SD_METADATA_WRITE_MICROS);
+      }
+      _open = true;
+      _writable = flags & (O_RDWR | O_WRITE);
+      _position = (flags & O_AT_END) ? file().size : 0;
+      _synced_size = file().size;
+      return true;
+    }
+    bool close() {
+      bool result = sync();
+      _open = false;
+      return result;
+    }
+    bool sync() {
+      if (!_open || !host_sd_present) {
+        return false;
+      }
+      if (_writable && _dirty) {
+        // the data block, and the directory entry (size)
+        host_sd_write_cost();
+        host_sd_write_cost(1, HOST_SD_METADATA_WRITE_MICROS);
+        if (clusters(file().size) != clusters(_synced_size)) {
+          host_sd_write_cost(1, HOST_SD_METADATA_WRITE_MICROS); // FAT
+        }
+        _synced_size = file().size;
+        _dirty = false;
+      }
+      return true;
+    }
+    uint32_t fileSize() { return _open ? file().size : 0; }
+    uint32_t size() { return fileSize(); }
+    uint32_t curPosition() { return _position; }
+    uint32_t position() { return _position; }
+    bool seekSet(uint32_t position) {
+      if (!_open || position > file().size) {
+        return false;
+      }
+      _position = position;
+      return true;
+    }
+    bool seek(uint32_t position) { return seekSet(position); }
+    int available() { return _open ? file().size - _position : 0; }
+    int read() {
+      uint8_t c;
+      return read(&c, 1) == 1 ? c : -1;
+    }
+    int read(void *buffer, size_t length) {
+      if (!_open || !host_sd_present) {
+        return -1;
+      }
+      HostSdFile &f = file();
+      size_t count = 0;
+      while (count < length && _position < f.size) {
+        if ((_position % HOST_SD_BLOCK_SIZE) == 0) {
+          host_sd_read_cost();
+        }
+        ((uint8_t *)buffer)[count++] = byteAt(_position++);
+      }
+      return count;
+    }
+    int fgets(char *line, int size, char * = NULL) {
+      int count = 0;
+      while (count < size - 1) {
+        int c = read();
+        if (c < 0) {
+          break;
+        }
+        line[count++] = c;
+        if (c == '\n') {
+          break;
+        }
+      }
+      line[count] = '\0';
+      return count;
+    }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const char *text) { return write(text, strlen(text)); }
+    size_t write(const void *data, size_t length) {
+      if (!_open || !_writable || !host_sd_present) {
+        return 0;
+      }
+      HostSdFile &f = file();
+      for (size_t i = 0; i < length; i++) {
+        if (f.contiguous && _position >= f.block_count * HOST_SD_BLOCK_SIZE) {
+          makeOrdinary();
+        }
+        if (((_position + 1) % HOST_SD_BLOCK_SIZE) == 0) {
+          host_sd_write_cost(); // a full block
+        }
+        setByteAt(_position++, ((const uint8_t *)data)[i]);
+        if (_position > f.size) {
+          f.size = _position;
+          if (!f.contiguous) {
+            f.data.resize(f.size);
+          }
+        }
+      }
+      _dirty = true;
+      return length;
+    }
+    size_t println(const char *text) {
+      return write(text) + write("\r\n");
+    }
+    size_t println() { return write("\r\n"); }
+    bool truncate(uint32_t length) {
+      if (!_open || !_writable || !host_sd_present) {
+        return false;
+      }
+      makeOrdinary();
+      file().data.resize(length);
+      file().size = length;
+      if (_position > length) {
+        _position = length;
+      }
+      _dirty = true;
+      return true;
+    }
+    bool createContiguous(const char *filename, uint32_t size) {
+      if (!host_sd_present) {
+        return false;
+      }
+      _name = host_sd_name(filename);
+      HostSdFile created;
+      created.contiguous = true;
+      created.first_block = host_sd_disk.size();
+      created.block_count = (size + HOST_SD_BLOCK_SIZE - 1) / HOST_SD_BLOCK_SIZE;
+      created.size = size;
+      host_sd_disk.resize(created.first_block + created.block_count, std::vector<uint8_t>(HOST_SD_BLOCK_SIZE, 0));
+      host_sd_files[_name] = created;
+      // the FAT chain and the directory entry
+      host_sd_write_cost(1 + created.block_count / (HOST_SD_CLUSTER_BLOCKS * 128), HOST_SD_METADATA_WRITE_MICROS);
+      _open = true;
+      _writable = true;
+      _position = 0;
+      _synced_size = size;
+      _dirty = false;
+      return true;
+    }
+    bool contiguousRange(uint32_t *first_block, uint32_t *last_block) {
+      if (!_open || !file().contiguous) {
+        return false;
+      }
+      *first_block = file().first_block;
+      *last_block = file().first_block + file().block_count - 1;
+      return true;
+    }
+  private:
+    std::string _name;
+    bool _open;
+    bool _writable;
+    bool _dirty;
+    uint32_t _position;
+    uint32_t _synced_size;
+    HostSdFile &file() { return host_sd_files[_name]; }
+    static uint32_t clusters(uint32_t size) {
+      return (size + HOST_SD_BLOCK_SIZE * HOST_SD_CLUSTER_BLOCKS - 1) / (HOST_SD_BLOCK_SIZE * HOST_SD_CLUSTER_BLOCKS);
+    }
+    uint8_t byteAt(uint32_t position) {
+      HostSdFile &f = file();
+      if (f.contiguous) {
+        return host_sd_disk[f.first_block + position / HOST_SD_BLOCK_SIZE][position % HOST_SD_BLOCK_SIZE];
+      }
+      return f.data[position];
+    }
+    void setByteAt(uint32_t position, uint8_t c) {
+      HostSdFile &f = file();
+      if (f.contiguous) {
+        host_sd_disk[f.first_block + position / HOST_SD_BLOCK_SIZE][position % HOST_SD_BLOCK_SIZE] = c;
+      } else {
+        if (position >= f.data.size()) {
+          f.data.resize(position + 1);
+        }
+        f.data[position] = c;
+      }
+    }
+    // the file grows past its contiguous blocks, or is truncated
+    void makeOrdinary() {
+      HostSdFile &f = file();
+      if (!f.contiguous) {
+        return;
+      }
+      std::string data;
+      for (uint32_t i = 0; i < f.block_count * HOST_SD_BLOCK_SIZE; i++) {
+        data += (char)host_sd_disk[f.first_block + i / HOST_SD_BLOCK_SIZE][i % HOST_SD_BLOCK_SIZE];
+      }
+      data.resize(f.size);
+      f.data = data;
+      f.contiguous = false;
+    }
+};
+
+class SdFat
+{
+  public:
+    bool begin(int) {
+      host_advance_micros(HOST_SD_BEGIN_MICROS);
+      return host_sd_present;
+    }
+    File open(const char *filename, uint8_t flags = O_RDONLY) {
+      File file;
+      file.open(filename, flags);
+      return file;
+    }
+    bool exists(const char *filename) {
+      if (!host_sd_present) {
+        return false;
+      }
+      host_sd_read_cost();
+      return host_sd_files.find(host_sd_name(filename)) != host_sd_files.end();
+    }
+    bool remove(const char *filename) {
+      if (!exists(filename)) {
+        return false;
+      }
+      host_sd_files.erase(host_sd_name(filename));
+      host_sd_write_cost(2, HOST_SD_METADATA_WRITE_MICROS);
+      return true;
+    }
+    // as in SdFat, fails if `to` exists
+    bool rename(const char *from, const char *to) {
+      if (!exists(from) || exists(to)) {
+        return false;
+      }
+      host_sd_files[host_sd_name(to)] = host_sd_files[host_sd_name(from)];
+      host_sd_files.erase(host_sd_name(from));
+      host_sd_write_cost(2, HOST_SD_METADATA_WRITE_MICROS);
+      return true;
+    }
+    bool mkdir(const char *) { return host_sd_present; }
+    uint8_t *cacheClear() { return NULL; }
+    SdCard *card() { return &_card; }
+  private:
+    SdCard _card;
+};
+
+#endif
@@ -0,0 +1,177 @@
+// A fake GPS receiver (MTK3339) for the host programs in tools/: a PPS pulse at the start of
+// each GPS second (through fake_input_capture.h), followed by the RMC and GGA sentences
+// for that second on its serial port.
+//
+// The timer's clock (host_micros) runs drift_ppm faster than GPS time, and GPS time
+// starts at start_epoch_seconds when host_micros is 0.
+// The program calls poll() as time passes (e.g. from the port's poll hook), which sends
+// the pulses and characters which are due. Characters take as long as they would at
+// the receiver's baud rate, and only arrive intact if the port is at the same baud rate.
+//
+// It also answers the PMTK commands which the timer sends (see UniGps::configureReceiver),
+// if they were sent at its baud rate, with a PMTK001 acknowledgement after ack_delay_micros:
+// - PMTK251 (baud rate): not acknowledged, the receiver switches (unless fast_baud is false)
+// - any other command: acknowledged as a success, or with reject_flag if it is reject_command
+// - nothing is acknowledged if answers is false
+#ifndef HOST_FAKE_GPS_RECEIVER_H
+#define HOST_FAKE_GPS_RECEIVER_H
+#include <Arduino.h>
+#include <time.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "fake_input_capture.h"
+
+typedef struct {
+  unsigned long arrival_micros;
+  char c;
+} HostGpsCharacter;
+
+class FakeGpsReceiver
+{
+  public:
+    FakeGpsReceiver(HostSerial *port, int pps_pin, unsigned long start_epoch_seconds) :
+      drift_ppm(0), baud(9600), sentence_delay_micros(50000), pps(true), fix(true),
+      answers(true), fast_baud(true), reject_command(-1), reject_flag(2), ack_delay_micros(20000),
+      _port(port), _pps_pin(pps_pin), _start_epoch_seconds(start_epoch_seconds), _next_second(1),
+      _sent_position(port->sent.size()) {}
+    double drift_ppm;
+    unsigned long baud;
+    unsigned long sentence_delay_micros; // from the pulse, to the start of the RMC sentence
+    bool pps;
+    bool fix;
+    bool answers;
+    bool fast_baud;
+    int reject_command;
+    int reject_flag;
+    unsigned long ack_delay_micros;
+    std::vector<std::string> commands; // the commands which it understood, e.g. "PMTK314,0,1,..."
+
+    // host_micros when GPS time is `seconds` (since start_epoch_seconds) + `micros`
+    unsigned long localMicros(unsigned long seconds, double micros = 0) {
+      return (unsigned long)((seconds * 1000000.0 + micros) * (1 + drift_ppm / 1000000));
+    }
+
+    // GPS time (microseconds since the epoch) when host_micros was local_micros
+    int64_t epochMicros(unsigned long local_micros) {
+      return (int64_t)_start_epoch_seconds * 1000000 + (int64_t)(local_micros / (1 + drift_ppm / 1000000) + 0.5);
+    }
+
+    void poll() {
+      readCommands();
+      while (localMicros(_next_second) <= host_micros) {
+        unsigned long pulse = localMicros(_next_second);
+        if (pps) {
+          host_capture_edge(_pps_pin, HIGH, pulse);
+        }
+        sendSentences(_start_epoch_seconds + _next_second, pulse + sentence_delay_micros);
+        _next_second++;
+      }
+      while (!_output.empty() && _output.front().arrival_micros <= host_micros) {
+        // at the wrong baud rate, the port gets framing errors and noise
+        _port->received += _port->baud == baud ? _output.front().c : '\xff';
+        _output.pop_front();
+      }
+    }
+
+  private:
+    HostSerial *_port;
+    int _pps_pin;
+    unsigned long _start_epoch_seconds;
+    unsigned long _next_second;
+    std::deque<HostGpsCharacter> _output;
+    size_t _sent_position;
+    std::string _command;
+
+    // Queue a sentence (the checksum and line ending are added), to start arriving at
+    // start_micros, or after anything already queued
+    void send(const char *sentence, unsigned long start_micros) {
+      uint8_t checksum = 0;
+      for (const char *c = sentence; *c; c++) {
+        checksum ^= *c;
+      }
+      char text[100];
+      snprintf(text, sizeof(text), "$%s*%02X\r\n", sentence, checksum);
+      unsigned long arrival = start_micros;
+      if (!_output.empty() && _output.back().arrival_micros > arrival) {
+        arrival = _output.back().arrival_micros;
+      }
+      unsigned long character_micros = 10000000UL / baud; // 8N1
+      for (char *c = text; *c; c++) {
+        arrival += character_micros;
+        HostGpsCharacter character = { arrival, *c };
+        _output.push_back(character);
+      }
+    }
+
+    // What the timer has sent since the last poll. It can only be understood if the port
+    // is at the receiver's baud rate (poll() is called on each write, see HostSerial).
+    void readCommands() {
+      for (; _sent_position < _port->sent.size(); _sent_position++) {
+        char c = _port->sent[_sent_position];
+        if (_port->baud != baud) {
+          _command.clear();
+          continue;
+        }
+        if (c == '$') {
+          _command.clear();
+        }
+        _command += c;
+        if (c == '\n') {
+          command(_command);
+          _command.clear();
+        }
+      }
+    }
+
+    // A command, $<body>*<checksum>\r\n
+    void command(const std::string &text) {
+      size_t star = text.find('*');
+      if (text[0] != '$' || star == std::string::npos || text.compare(0, 5, "$PMTK") != 0) {
+        return;
+      }
+      std::string body = text.substr(1, star - 1);
+      uint8_t checksum = 0;
+      for (size_t i = 0; i < body.size(); i++) {
+        checksum ^= body[i];
+      }
+      int number = atoi(body.c_str() + 4);
+      if (strtoul(text.c_str() + star + 1, NULL, 16) != checksum) {
+        acknowledge(number, 0); // invalid
+        return;
+      }
+      commands.push_back(body);
+      if (number == 251) {
+        if (fast_baud) {
+          baud = strtoul(body.c_str() + 8, NULL, 10);
+          _output.clear(); // cut off by the change
+        }
+        return;
+      }
+      acknowledge(number, number == reject_command ? reject_flag : 3);
+    }
+
+    void acknowledge(int number, int flag) {
+      if (!answers) {
+        return;
+      }
+      char ack[40];
+      snprintf(ack, sizeof(ack), "PMTK001,%d,%d", number, flag);
+      send(ack, host_micros + ack_delay_micros);
+    }
+
+    void sendSentences(unsigned long epoch_seconds, unsigned long start_micros) {
+      time_t seconds = epoch_seconds;
+      struct tm utc;
+      gmtime_r(&seconds, &utc);
+      char sentence[100];
+      snprintf(sentence, sizeof(sentence), "GPRMC,%02d%02d%02d.000,%c,5130.0000,N,00010.0000,W,0.00,0.00,%02d%02d%02d,,,A",
+        utc.tm_hour, utc.tm_min, utc.tm_sec, fix ? 'A' : 'V', utc.tm_mday, utc.tm_mon + 1, utc.tm_year % 100);
+      send(sentence, start_micros);
+      snprintf(sentence, sizeof(sentence), "GPGGA,%02d%02d%02d.000,5130.0000,N,00010.0000,W,%d,08,1.0,100.0,M,47.0,M,,",
+        utc.tm_hour, utc.tm_min, utc.tm_sec, fix ? 1 : 0);
+      send(sentence, start_micros);
+    }
+};
+
+#endif
@@ -0,0 +1,95 @@
+// A fake of input_capture.cpp, for the host programs in tools/: include this instead of it.
+//
+// The program makes an edge happen with host_capture_edge(pin, level, edge_micros), which calls
+// the handler as the timer would:
+// - on a pin which the Teensy LC can timestamp in hardware (the TPM0 pins, as in
+//   input_capture.cpp), with the time of the edge
+// - on any other pin (attachInterrupt + micros()), with the time at which the interrupt
+//   got to micros(): HOST_CAPTURE_LATENCY_MICROS after the edge, plus up to
+//   host_capture_jitter_micros more (when another interrupt was running)
+// The latencies are estimates for a 48MHz Cortex-M0+, not measurements.
+#ifndef HOST_FAKE_INPUT_CAPTURE_H
+#define HOST_FAKE_INPUT_CAPTURE_H
+#include <Arduino.h>
+#include "input_capture.h"
+
+#define HOST_CAPTURE_LATENCY_MICROS 3
+static unsigned long host_capture_jitter_micros = 20;
+
+typedef struct {
+  int pin; // -1 when the slot is free
+  capture_handler handler;
+  bool hardware;
+} HostCaptureSlot;
+
+static HostCaptureSlot host_capture_slots[INPUT_CAPTURE_SLOTS] = {
+  { -1, NULL, false },
+  { -1, NULL, false }
+};
+
+// The pins wired to a TPM0 channel, false to make a pin use the software fallback
+static bool host_capture_hardware_pins[64] = { false };
+
+inline void host_capture_default_pins() {
+  const uint8_t pins[] = { 2, 22, 23, 9, 10, 6, 20 };
+  for (unsigned int i = 0; i < sizeof(pins); i++) {
+    host_capture_hardware_pins[pins[i]] = true;
+  }
+}
+
+bool capture_attach(int pin, capture_handler handler, int) {
+  capture_detach(pin);
+  for (int i = 0; i < INPUT_CAPTURE_SLOTS; i++) {
+    if (host_capture_slots[i].pin == -1) {
+      host_capture_slots[i].pin = pin;
+      host_capture_slots[i].handler = handler;
+      host_capture_slots[i].hardware = host_capture_hardware_pins[pin];
+      return true;
+    }
+  }
+  return false;
+}
+
+void capture_detach(int pin) {
+  for (int i = 0; i < INPUT_CAPTURE_SLOTS; i++) {
+    if (host_capture_slots[i].pin == pin) {
+      host_capture_slots[i].pin = -1;
+    }
+  }
+}
+
+bool capture_is_hardware(int pin) {
+  for (int i = 0; i < INPUT_CAPTURE_SLOTS; i++) {
+    if (host_capture_slots[i].pin == pin) {
+      return host_capture_slots[i].hardware;
+    }
+  }
+  return false;
+}
+
+// The pin changes to level at edge_micros, and the handler runs (if the pin is attached,
+// the mode isn't checked). The interrupt is taken to have interrupted whatever the
+// program was doing at edge_micros, even if host_micros has already gone past it.
+// return false if the pin isn't attached
+inline bool host_capture_edge(int pin, uint8_t level, unsigned long edge_micros) {
+  host_pin_level(pin, level);
+  for (int i = 0; i < INPUT_CAPTURE_SLOTS; i++) {
+    if (host_capture_slots[i].pin != pin) {
+      continue;
+    }
+    unsigned long latency = HOST_CAPTURE_LATENCY_MICROS;
+    if (!host_capture_slots[i].hardware) {
+      latency += rand() % (host_capture_jitter_micros + 1);
+    }
+    unsigned long now = host_micros;
+    host_micros = edge_micros + latency;
+    host_capture_slots[i].handler(host_capture_slots[i].hardware ? edge_micros : micros());
+    if ((long)(now - host_micros) > 0) {
+      host_micros = now;
+    }
+    return true;
+  }
+  return false;
+}
+
+#endif
@@ -0,0 +1,139 @@
+// Times sensor crossings on a PC, through the same code as the timer (UniSensor, UniGps,
+// accurate_timing.cpp, the crossing filter), with the input capture faked (tools/host),
+// to see how close each crossing's time is to when it really happened.
+//
+//   g++ -O2 -std=gnu++11 -I tools/host -I . -include Arduino.h -o input_capture_sim tools/input_capture_sim.cpp
+//   ./input_capture_sim [CROSSINGS]
+//
+// A fake receiver sends the PPS and the sentences, and the timer's clock runs 25ppm fast.
+// After a minute (so that the clock model has learnt the drift), racers cross the sensor
+// at random times, each blocking it for 20-60ms. This is done with the sensor and the PPS on
+// hardware capture pins, and with either of them using the software fallback (attachInterrupt).
+// Each crossing's time must be within its error bound (error_micros), or this fails.
+#include "uni_sd.cpp"
+#include "uni_config.cpp"
+#include "uni_gps.cpp"
+#include "uni_sensor.cpp"
+#include "accurate_timing.cpp"
+#include "crossing_queue.cpp"
+#include "crossing_filter.cpp"
+#include "diagnostics.cpp"
+#include "nmea_parser.cpp"
+#include "clock_model.cpp"
+#include "clock_state.cpp"
+#include "epoch_time.cpp"
+#include "serial_log.cpp"
+#include "event_log.cpp"
+#include "fake_gps_receiver.h"
+
+#define PPS_PIN 2
+#define SENSOR_PIN 5 // as on the v2 PCB
+// 2018-06-30 10:00:00 UTC
+#define START_EPOCH_SECONDS 1530352800UL
+#define SETTLE_SECONDS 60
+#define LOOP_MICROS 200 // one pass of the main loop
+
+UniSd sd(10);
+UniConfig config;
+UniGps gps(PPS_PIN);
+UniSensor sensor(SENSOR_PIN);
+FakeGpsReceiver receiver(&Serial2, PPS_PIN, START_EPOCH_SECONDS);
+
+void poll_receiver() {
+  receiver.poll();
+}
+
+// Run the main loop until host_micros reaches until_micros
+void run_until(unsigned long until_micros) {
+  while ((long)(until_micros - host_micros) > 0) {
+    receiver.poll();
+    gps.readData();
+    host_micros += LOOP_MICROS;
+  }
+}
+
+typedef struct {
+  const char *name;
+  bool sensor_hardware;
+  bool pps_hardware;
+} CaptureSetup;
+
+// return false if a crossing was lost, or outside its error bound
+bool time_crossings(const CaptureSetup *setup, int crossings) {
+  host_micros = 0;
+  receiver = FakeGpsReceiver(&Serial2, PPS_PIN, START_EPOCH_SECONDS);
+  receiver.drift_ppm = 25;
+  gps = UniGps(PPS_PIN);
+  host_capture_hardware_pins[PPS_PIN] = setup->pps_hardware;
+  host_capture_hardware_pins[SENSOR_PIN] = setup->sensor_hardware;
+  gps.setup(&pps_interrupt);
+  sensor.setup(&sensor_interrupt);
+  sensor.attach_interrupt();
+  clear_sensor_crossings();
+  run_until(receiver.localMicros(SETTLE_SECONDS));
+  if (!gps.lock()) {
+    printf("%s: no GPS lock\n", setup->name);
+    return false;
+  }
+
+  long worst = 0;
+  long total = 0;
+  unsigned long worst_bound = 0;
+  int outside_bound = 0;
+  for (int i = 0; i < crossings; i++) {
+    // the racer crosses between 0.5 and 1.5 seconds after the last one
+    unsigned long blocked = host_micros + 500000 + rand() % 1000000;
+    unsigned long cleared = blocked + 20000 + rand() % 40000;
+    int64_t true_time = receiver.epochMicros(blocked);
+    run_until(blocked);
+    host_capture_edge(SENSOR_PIN, HIGH, blocked);
+    run_until(cleared);
+    host_capture_edge(SENSOR_PIN, LOW, cleared);
+    // past the merge gap, so that the crossing is complete
+    run_until(cleared + config.get_finish_line_spacing() * 1000UL + 1000);
+    TimeResult result;
+    if (!nextSensorTime(&result)) {
+      printf("%s: crossing %d was lost\n", setup->name, i);
+      return false;
+    }
+    long error = (long)(result.epoch_micros - true_time);
+    if (labs(error) > labs(worst)) {
+      worst = error;
+    }
+    if (result.error_micros > worst_bound) {
+      worst_bound = result.error_micros;
+    }
+    total += labs(error);
+    if ((unsigned long)labs(error) > result.error_micros) {
+      outside_bound++;
+    }
+  }
+  sensor.detach_interrupt();
+  printf("%-36s mean error %5.1fus, worst %4ldus, worst error bound %4luus, %d outside their bound\n",
+    setup->name, (double)total / crossings, worst, worst_bound, outside_bound);
+  return outside_bound == 0;
+}
+
+int main(int argc, char **argv) {
+  int crossings = argc > 1 ? atoi(argv[1]) : 200;
+  if (crossings < 1) {
+    printf("usage: input_capture_sim [CROSSINGS]\n");
+    return 1;
+  }
+  srand(1);
+  Serial.echo = false; // only show the results
+  sd.setup();
+  config.setup();
+  Serial2.poll = &poll_receiver;
+  CaptureSetup setups[] = {
+    { "sensor and PPS on hardware capture", true, true },
+    { "sensor on software capture", false, true },
+    { "PPS on software capture", true, false },
+    { "sensor and PPS on software capture", false, false },
+  };
+  bool ok = true;
+  for (unsigned int i = 0; i < sizeof(setups) / sizeof(setups[0]); i++) {
+    ok = time_crossings(&setups[i], crossings) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,397 @@
+// Merge the race files of several timers, and rank the racers in each category.
+//
+// This runs on a PC, not on the timer:
+//   g++ -O2 -std=c++11 -pthread -o merge_results tools/merge_results.cpp
+//   ./merge_results [--tolerance-ms N] [--penalty S] [--threads N] unit*/race_*.txt > rankings.csv
+//
+// Each file is named race_<difficulty>_<Up|Down>_<Start|Finish>_<n>.txt (see UniConfig::filename),
+// files from different timers with the same name go in different directories.
+// The category is <difficulty>_<Up|Down>_<n>; a category can have any number of start and finish files.
+//
+// - the files are read and sorted in parallel (one thread per file, up to --threads)
+// - CLEAR_PREVIOUS cancels the result before it, in the same file
+// - the start files, and the finish files, of each category are merged in time order (k-way merge)
+// - finishes of the same bib from different finish timers within --tolerance-ms (default 500)
+//   are one crossing (redundant timers), the earliest time is used
+// - otherwise, if a bib has more than one start (or finish), the last one is used
+// - a start with a fault has --penalty seconds (default 10) added
+//
+// The output is CSV: category,rank,bib,elapsed seconds,fault
+// racers without a start or finish are listed after the ranked racers, as DNS/DNF
+//
+// To measure the speed, generate synthetic race files:
+//   ./merge_results --generate DIR RECORDS
+// writes 2 start timers and 2 (redundant) finish timers, RECORDS results in total, spread over
+// 6 categories (more if needed, so that each racer has their own bib in their category)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define LINE_LENGTH 128
+// Warnings about duplicate bibs (etc.) are only shown this many times, then counted
+#define MAX_WARNINGS 20
+
+static int64_t tolerance_micros = 500000;
+static int64_t penalty_micros = 10000000;
+static unsigned long warnings = 0;
+
+typedef struct {
+  int64_t micros; // since midnight of the race day
+  int bib;
+  bool fault;
+  int file; // index in files
+} Entry;
+
+typedef struct {
+  std::string path;
+  std::string category;
+  bool finish;
+  std::vector<Entry> entries; // in time order, after read_file()
+  unsigned long cleared;
+  bool ok;
+} RaceFile;
+
+static std::vector<RaceFile> files;
+
+static void warn(const char *format, const char *name, int bib) {
+  if (++warnings <= MAX_WARNINGS) {
+    fprintf(stderr, format, name, bib);
+  }
+}
+
+// race_Expert_Up_Finish_1.txt -> category Expert_Up_1, finish
+static bool parse_filename(RaceFile *file) {
+  const char *name = strrchr(file->path.c_str(), '/');
+  name = name == NULL ? file->path.c_str() : name + 1;
+  char difficulty[32], direction[32], line[32];
+  int number;
+  if (sscanf(name, "race_%31[^_]_%31[^_]_%31[^_]_%d.txt", difficulty, direction, line, &number) != 4) {
+    return false;
+  }
+  if (strcmp(line, "Start") != 0 && strcmp(line, "Finish") != 0) {
+    return false;
+  }
+  file->finish = strcmp(line, "Finish") == 0;
+  file->category = std::string(difficulty) + "_" + direction + "_" + std::to_string(number);
+  return true;
+}
+
+// A result line, see format_race_line (recording.cpp)
+static bool parse_line(const char *line, Entry *entry) {
+  long minute;
+  int second, millisecond, fault, microsecond = 0;
+  if (sscanf(line, "%d,,%ld,%d,%d,%d,%d", &entry->bib, &minute, &second, &millisecond, &fault, &microsecond) < 5) {
+    return false;
+  }
+  entry->micros = ((int64_t)(minute * 60 + second) * 1000 + millisecond) * 1000 + microsecond;
+  entry->fault = fault == 1;
+  return true;
+}
+
+// Read one file, line by line, and sort it by time
+static void read_file(int index) {
+  RaceFile *file = &files[index];
+  FILE *input = fopen(file->path.c_str(), "r");
+  if (input == NULL) {
+    perror(file->path.c_str());
+    file->ok = false;
+    return;
+  }
+  char line[LINE_LENGTH];
+  Entry entry;
+  entry.file = index;
+  while (fgets(line, sizeof(line), input) != NULL) {
+    if (parse_line(line, &entry)) {
+      file->entries.push_back(entry);
+    } else if (strncmp(line, "CLEAR_PREVIOUS", 14) == 0 && !file->entries.empty()) {
+      file->entries.pop_back();
+      file->cleared++;
+    }
+  }
+  file->ok = !ferror(input);
+  fclose(input);
+  // the timer writes in time order, except results entered late (mode 6), so this is usually quick
+  std::stable_sort(file->entries.begin(), file->entries.end(),
+    [](const Entry &a, const Entry &b) { return a.micros < b.micros; });
+}
+
+static void read_files(unsigned thread_count) {
+  std::atomic<int> next(0);
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < thread_count; i++) {
+    threads.push_back(std::thread([&next]() {
+      int index;
+      while ((index = next++) < (int)files.size()) {
+        read_file(index);
+      }
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+// Position in one file, for the k-way merge
+typedef struct {
+  int64_t micros;
+  int file;
+  size_t position;
+} Cursor;
+
+struct LaterCursor {
+  bool operator()(const Cursor &a, const Cursor &b) const {
+    return a.micros > b.micros || (a.micros == b.micros && a.file > b.file);
+  }
+};
+
+// Call handler for each entry of the given files, in time order
+template <typename Handler>
+static void merge(const std::vector<int> &file_indexes, Handler handler) {
+  std::priority_queue<Cursor, std::vector<Cursor>, LaterCursor> heap;
+  for (size_t i = 0; i < file_indexes.size(); i++) {
+    const RaceFile &file = files[file_indexes[i]];
+    if (!file.entries.empty()) {
+      Cursor cursor = { file.entries[0].micros, file_indexes[i], 0 };
+      heap.push(cursor);
+    }
+  }
+  while (!heap.empty()) {
+    Cursor cursor = heap.top();
+    heap.pop();
+    const RaceFile &file = files[cursor.file];
+    handler(file.entries[cursor.position]);
+    if (++cursor.position < file.entries.size()) {
+      cursor.micros = file.entries[cursor.position].micros;
+      heap.push(cursor);
+    }
+  }
+}
+
+typedef struct {
+  bool started;
+  bool finished;
+  bool fault;
+  int64_t start;
+  int64_t finish;
+  int finish_file;
+} Racer;
+
+typedef struct {
+  int bib;
+  int64_t elapsed;
+  bool fault;
+} Ranked;
+
+static void rank_category(const std::string &category, const std::vector<int> &starts, const std::vector<int> &finishes) {
+  std::map<int, Racer> racers; // by bib
+  unsigned long redundant = 0;
+
+  merge(starts, [&](const Entry &entry) {
+    Racer &racer = racers[entry.bib];
+    if (racer.started) {
+      warn("%s: bib %d started more than once, using the last start\n", category.c_str(), entry.bib);
+    }
+    racer.started = true;
+    racer.start = entry.micros;
+    racer.fault = entry.fault;
+  });
+  merge(finishes, [&](const Entry &entry) {
+    Racer &racer = racers[entry.bib];
+    if (racer.finished && racer.finish_file != entry.file && entry.micros - racer.finish <= tolerance_micros) {
+      // the same crossing, from another finish timer
+      redundant++;
+      return;
+    }
+    if (racer.finished) {
+      warn("%s: bib %d finished more than once, using the last finish\n", category.c_str(), entry.bib);
+    }
+    racer.finished = true;
+    racer.finish = entry.micros;
+    racer.finish_file = entry.file;
+  });
+
+  std::vector<Ranked> ranked;
+  for (std::map<int, Racer>::iterator i = racers.begin(); i != racers.end(); ++i) {
+    const Racer &racer = i->second;
+    if (racer.started && racer.finished && racer.finish >= racer.start) {
+      Ranked result = { i->first, racer.finish - racer.start + (racer.fault ? penalty_micros : 0), racer.fault };
+      ranked.push_back(result);
+    }
+  }
+  std::stable_sort(ranked.begin(), ranked.end(),
+    [](const Ranked &a, const Ranked &b) { return a.elapsed < b.elapsed; });
+
+  for (size_t i = 0; i < ranked.size(); i++) {
+    printf("%s,%lu,%d,%lld.%06lld,%d\n", category.c_str(), (unsigned long)(i + 1), ranked[i].bib,
+      (long long)(ranked[i].elapsed / 1000000), (long long)(ranked[i].elapsed % 1000000), ranked[i].fault ? 1 : 0);
+  }
+  for (std::map<int, Racer>::iterator i = racers.begin(); i != racers.end(); ++i) {
+    const Racer &racer = i->second;
+    if (!racer.started) {
+      printf("%s,,%d,DNS,0\n", category.c_str(), i->first);
+    } else if (!racer.finished) {
+      printf("%s,,%d,DNF,%d\n", category.c_str(), i->first, racer.fault ? 1 : 0);
+    } else if (racer.finish < racer.start) {
+      printf("%s,,%d,ERR,%d\n", category.c_str(), i->first, racer.fault ? 1 : 0);
+    }
+  }
+  fprintf(stderr, "%s: %lu ranked, %lu redundant finishes merged\n", category.c_str(), (unsigned long)ranked.size(), redundant);
+}
+
+// Synthetic race files, for measuring the speed
+// Bibs are 1-4 digits, so there are enough categories for each racer to have their own bib
+#define GENERATE_MAX_BIB 9999
+#define GENERATE_MIN_CATEGORIES 6
+
+// mkdir -p, for one level
+static bool make_directory(const std::string &path) {
+  if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+    perror(path.c_str());
+    return false;
+  }
+  return true;
+}
+
+static int generate(const char *directory, long records) {
+  const char *units[] = { "start_a", "start_b", "finish_a", "finish_b" };
+  const char *difficulties[] = { "Beginner", "Advanced", "Expert" };
+  const char *directions[] = { "Up", "Down" };
+  if (!make_directory(directory)) {
+    return 1;
+  }
+  for (int i = 0; i < 4; i++) {
+    if (!make_directory(std::string(directory) + "/" + units[i])) {
+      return 1;
+    }
+  }
+  long categories = std::max((long)GENERATE_MIN_CATEGORIES, (records + GENERATE_MAX_BIB - 1) / GENERATE_MAX_BIB);
+  srand(1);
+  for (long category = 0; category < categories; category++) {
+    // e.g. Expert_Up_1, see parse_filename()
+    char name[64];
+    snprintf(name, sizeof(name), "%s_%s_%%s_%ld.txt", difficulties[category % 3], directions[category / 3 % 2],
+      category / 6 + 1);
+    FILE *output[4];
+    for (int i = 0; i < 4; i++) {
+      char filename[80];
+      snprintf(filename, sizeof(filename), name, i < 2 ? "Start" : "Finish");
+      std::string path = std::string(directory) + "/" + units[i] + "/race_" + filename;
+      output[i] = fopen(path.c_str(), "w");
+      if (output[i] == NULL) {
+        perror(path.c_str());
+        return 1;
+      }
+    }
+    // the racers of all of the categories start in turn
+    for (long i = category; i < records; i += categories) {
+      int bib = i / categories + 1;
+      int64_t start = (int64_t)600 * 60000000 + i * 1000 + rand() % 1000; // a start every ms
+      int64_t finish = start + 60000000 + rand() % 30000000;
+      int start_unit = i % 2;
+      int fault = rand() % 100 == 0;
+      fprintf(output[start_unit], "%d,,%02lld,%02lld,%03lld,%d,%03lld\r\n", bib, (long long)(start / 60000000),
+        (long long)(start / 1000000 % 60), (long long)(start / 1000 % 1000), fault, (long long)(start % 1000));
+      if (rand() % 200 == 0) {
+        fprintf(output[start_unit], "CLEAR_PREVIOUS\r\n");
+      }
+      for (int unit = 2; unit < 4; unit++) {
+        int64_t time = finish + rand() % 2000; // the finish timers differ by up to 2ms
+        fprintf(output[unit], "%d,,%02lld,%02lld,%03lld,0,%03lld\r\n", bib, (long long)(time / 60000000),
+          (long long)(time / 1000000 % 60), (long long)(time / 1000 % 1000), (long long)(time % 1000));
+      }
+    }
+    for (int i = 0; i < 4; i++) {
+      fclose(output[i]);
+    }
+  }
+  return 0;
+}
+
+static int usage(const char *program) {
+  fprintf(stderr, "usage: %s [--tolerance-ms N] [--penalty S] [--threads N] race_*.txt ...\n"
+    "       %s --generate DIR RECORDS\n", program, program);
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  unsigned thread_count = std::thread::hardware_concurrency();
+  int first_file = 1;
+  while (first_file < argc && strncmp(argv[first_file], "--", 2) == 0) {
+    const char *option = argv[first_file];
+    if (strcmp(option, "--generate") == 0 && first_file + 2 < argc) {
+      return generate(argv[first_file + 1], atol(argv[first_file + 2]));
+    } else if (first_file + 1 >= argc) {
+      return usage(argv[0]);
+    } else if (strcmp(option, "--tolerance-ms") == 0) {
+      tolerance_micros = atol(argv[++first_file]) * 1000LL;
+    } else if (strcmp(option, "--penalty") == 0) {
+      penalty_micros = atol(argv[++first_file]) * 1000000LL;
+    } else if (strcmp(option, "--threads") == 0) {
+      thread_count = atoi(argv[++first_file]);
+    } else {
+      return usage(argv[0]);
+    }
+    first_file++;
+  }
+  if (first_file == argc) {
+    return usage(argv[0]);
+  }
+  if (thread_count == 0) {
+    thread_count = 1;
+  }
+
+  for (int i = first_file; i < argc; i++) {
+    RaceFile file;
+    file.path = argv[i];
+    file.cleared = 0;
+    file.ok = true;
+    if (!parse_filename(&file)) {
+      fprintf(stderr, "%s: not a race file (race_<difficulty>_<Up|Down>_<Start|Finish>_<n>.txt), skipped\n", argv[i]);
+      continue;
+    }
+    files.push_back(file);
+  }
+
+  std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+  read_files(thread_count);
+  std::chrono::steady_clock::time_point read_time = std::chrono::steady_clock::now();
+
+  int result = 0;
+  unsigned long records = 0;
+  std::map<std::string, std::pair<std::vector<int>, std::vector<int> > > categories; // starts, finishes
+  for (size_t i = 0; i < files.size(); i++) {
+    if (!files[i].ok) {
+      result = 1;
+    }
+    records += files[i].entries.size();
+    std::pair<std::vector<int>, std::vector<int> > &category = categories[files[i].category];
+    (files[i].finish ? category.second : category.first).push_back(i);
+  }
+  printf("category,rank,bib,elapsed,fault\n");
+  for (std::map<std::string, std::pair<std::vector<int>, std::vector<int> > >::iterator i = categories.begin();
+       i != categories.end(); ++i) {
+    rank_category(i->first, i->second.first, i->second.second);
+  }
+  std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+
+  if (warnings > MAX_WARNINGS) {
+    fprintf(stderr, "... %lu warnings in total\n", warnings);
+  }
+  fprintf(stderr, "%lu records from %lu files, read+sort %.0fms (%u threads), merge+rank %.0fms\n",
+    records, (unsigned long)files.size(),
+    std::chrono::duration<double, std::milli>(read_time - start_time).count(), thread_count,
+    std::chrono::duration<double, std::milli>(end_time - read_time).count());
+  return result;
+}
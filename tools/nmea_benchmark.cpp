@@ -0,0 +1,150 @@
+// Measures how fast NmeaParser (nmea_parser.cpp) reads the receiver's output on a PC,
+// and, if it is built with TinyGPS (which the timer used before), compares the two.
+//
+//   g++ -O2 -std=gnu++11 -I tools/host -I . -include Arduino.h -o nmea_benchmark tools/nmea_benchmark.cpp
+//   ./nmea_benchmark [SECONDS_OF_OUTPUT]
+//
+// With TinyGPS 13 (https://github.com/mikalhart/TinyGPS) in ../TinyGPS:
+//   g++ -O2 -std=gnu++11 -DARDUINO=100 -DWITH_TINYGPS -I tools/host -I . -I ../TinyGPS -include Arduino.h -o nmea_benchmark tools/nmea_benchmark.cpp
+//
+// The input is what an MTK3339 sends before it is configured (RMC, GGA, GSA, 3 GSV, VTG each
+// second) with a corrupted sentence every 10 seconds. Each parser gets it one character at a
+// time, and on each complete sentence the time is read as uni_gps.cpp does (and, for TinyGPS,
+// the position, as the old lock() did).
+// Reported: bytes per second, and the slowest single call (encode() plus the reads after it).
+// The slowest call is the 99.99th percentile as well as the maximum, as the maximum
+// includes the PC's own interruptions. These are PC timings: only the ratio between
+// the parsers says anything about the timer.
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "nmea_parser.cpp"
+#ifdef WITH_TINYGPS
+#include "TinyGPS.cpp"
+#endif
+
+// 2018-06-30 10:00:00 UTC
+#define START_EPOCH_SECONDS 1530352800UL
+#define TIMED_REPEATS 20
+
+std::string sentence(const char *body) {
+  uint8_t checksum = 0;
+  for (const char *c = body; *c; c++) {
+    checksum ^= *c;
+  }
+  char text[120];
+  snprintf(text, sizeof(text), "$%s*%02X\r\n", body, checksum);
+  return text;
+}
+
+std::string receiver_output(int seconds) {
+  std::string output;
+  char body[100];
+  for (int i = 0; i < seconds; i++) {
+    time_t now = START_EPOCH_SECONDS + i;
+    struct tm utc;
+    gmtime_r(&now, &utc);
+    snprintf(body, sizeof(body), "GPRMC,%02d%02d%02d.000,A,5130.1234,N,00010.5678,W,0.02,31.66,%02d%02d%02d,,,A",
+      utc.tm_hour, utc.tm_min, utc.tm_sec, utc.tm_mday, utc.tm_mon + 1, utc.tm_year % 100);
+    std::string rmc = sentence(body);
+    if (i % 10 == 9) {
+      rmc[20] ^= 0x04; // a corrupted character, the checksum fails
+    }
+    output += rmc;
+    snprintf(body, sizeof(body), "GPGGA,%02d%02d%02d.000,5130.1234,N,00010.5678,W,1,09,0.92,100.1,M,47.0,M,,",
+      utc.tm_hour, utc.tm_min, utc.tm_sec);
+    output += sentence(body);
+    output += sentence("GPGSA,A,3,10,07,05,02,29,04,08,13,,,,,1.72,1.03,1.38");
+    output += sentence("GPGSV,3,1,11,10,63,137,17,07,61,098,15,05,59,290,20,08,54,157,30");
+    output += sentence("GPGSV,3,2,11,02,39,223,19,13,28,070,17,26,23,252,,04,14,186,14");
+    output += sentence("GPGSV,3,3,11,29,09,301,24,16,09,020,,36,,,");
+    output += sentence("GPVTG,31.66,T,,M,0.02,N,0.04,K,A");
+  }
+  return output;
+}
+
+uint64_t nanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// One character, and what the timer does when a sentence is complete
+// return true if a sentence was complete
+unsigned long checked_time = 0;
+
+inline bool feed(NmeaParser *parser, char c) {
+  if (!parser->encode(c)) {
+    return false;
+  }
+  unsigned long date, time, age;
+  parser->get_datetime(&date, &time, &age);
+  checked_time += time + parser->fixAge();
+  return true;
+}
+
+#ifdef WITH_TINYGPS
+inline bool feed(TinyGPS *parser, char c) {
+  if (!parser->encode(c)) {
+    return false;
+  }
+  unsigned long date, time, age;
+  float latitude, longitude;
+  parser->get_datetime(&date, &time, &age);
+  parser->f_get_position(&latitude, &longitude, &age);
+  checked_time += time + age;
+  return true;
+}
+#endif
+
+template<typename Parser> void benchmark(const char *name, const std::string &input) {
+  // throughput: the whole input, a few times, with a new parser each time
+  unsigned long sentences = 0;
+  uint64_t start = nanoseconds();
+  for (int repeat = 0; repeat < TIMED_REPEATS; repeat++) {
+    Parser parser;
+    for (size_t i = 0; i < input.size(); i++) {
+      sentences += feed(&parser, input[i]);
+    }
+  }
+  double seconds = (nanoseconds() - start) / 1e9;
+
+  // each call
+  std::vector<uint32_t> calls;
+  calls.reserve(input.size());
+  Parser parser;
+  // the cost of reading the clock
+  uint64_t overhead = UINT64_MAX;
+  for (int i = 0; i < 1000; i++) {
+    uint64_t before = nanoseconds();
+    overhead = std::min(overhead, nanoseconds() - before);
+  }
+  for (size_t i = 0; i < input.size(); i++) {
+    uint64_t before = nanoseconds();
+    feed(&parser, input[i]);
+    uint64_t taken = nanoseconds() - before;
+    calls.push_back(taken > overhead ? taken - overhead : 0);
+  }
+  std::sort(calls.begin(), calls.end());
+  printf("%-10s %6.1f MB/s, %lu valid sentences, each call: median %uns, 99.99%% %uns, max %uns\n",
+    name, input.size() * TIMED_REPEATS / seconds / 1e6, sentences / TIMED_REPEATS,
+    calls[calls.size() / 2], calls[calls.size() - 1 - calls.size() / 10000], calls.back());
+}
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 3600;
+  if (seconds < 1) {
+    printf("usage: nmea_benchmark [SECONDS_OF_OUTPUT]\n");
+    return 1;
+  }
+  std::string input = receiver_output(seconds);
+  printf("%d seconds of receiver output, %zu bytes\n", seconds, input.size());
+  benchmark<NmeaParser>("NmeaParser", input);
+#ifdef WITH_TINYGPS
+  benchmark<TinyGPS>("TinyGPS", input);
+#else
+  printf("TinyGPS: not built in (see the top of tools/nmea_benchmark.cpp)\n");
+#endif
+  return checked_time == 0; // so that the reads aren't optimised away
+}
@@ -0,0 +1,135 @@
+// Times the scan of the race file when Mode 5/6 is entered (rebuild_race_index in recording.cpp),
+// which rebuilds the race index and finds the racers who already have a result (dUP), on a PC.
+//
+//   g++ -O2 -std=gnu++11 -I tools/host -I . -include Arduino.h -o race_index_scan tools/race_index_scan.cpp
+//   ./race_index_scan [LINES]
+//
+// The race file has LINES lines (5000 by default): results of bibs 1..9999, with re-runs,
+// and CLEAR_PREVIOUS lines (up to 3 in a row, often straight after a re-run).
+// The racers found are checked against the race file, as Mode 4.5 reads it.
+//
+// Two times are reported: the CPU time of the scan on this PC, and micros() of
+// tools/host/SdFat.h, an estimate of the card's time on the timer (which dominates there).
+// Neither is a measurement on the timer, which logs the real one ("Race file scanned ...").
+#include <ctime>
+#include <vector>
+#include "uni_sd.cpp"
+#include "uni_config.cpp"
+#include "event_log.cpp"
+#include "serial_log.cpp"
+#include "epoch_time.cpp"
+#include "journal.cpp"
+#include "clock_state.cpp"
+#include "clock_model.cpp"
+#include "nmea_parser.cpp"
+#include "recording.cpp"
+
+// The rest of the timer, which recording.cpp uses, does nothing here
+UniDisplay::UniDisplay(int) {}
+void UniDisplay::duplicate() {}
+void UniDisplay::clear() {}
+void UniDisplay::sd() {}
+void UniDisplay::showNumber(int) {}
+void UniDisplay::showNumber(int, int) {}
+UniKeypad::UniKeypad(byte, byte, byte, byte, byte, byte, byte, byte) {}
+uint8_t UniKeypad::intFromChar(char) { return 0; }
+char UniKeypad::lastKeyPressed() { return NO_KEY; }
+UniGps::UniGps(int) {}
+bool UniGps::holdover() { return false; }
+UniBuzzer::UniBuzzer(int) {}
+void UniBuzzer::warning() {}
+void mode6_replay(JournalRecord *) {}
+void mode6_clear_results() {}
+bool currentTime(TimeResult *) { return false; }
+
+UniSd sd(10);
+UniConfig config;
+UniDisplay display(0x70);
+UniKeypad keypad(0, 0, 0, 0, 0, 0, 0, 0);
+UniGps gps(2);
+UniBuzzer buzzer(4);
+
+#define MAX_BIB 9999
+// 2018-07-01 10:00:00 UTC
+#define START_EPOCH_SECONDS 1530439200LL
+
+// Write the race file, return the bibs of the results which aren't cleared
+std::vector<int> write_race_file(const char *filename, int lines) {
+  std::vector<int> results;
+  std::vector<int> bibs; // every result written, to pick re-runs from
+  EpochMicros when = START_EPOCH_SECONDS * 1000000LL;
+  char line[SD_LINE_LENGTH];
+  int written = 0;
+  while (written < lines) {
+    int bib;
+    if (!bibs.empty() && rand() % 10 == 0) {
+      bib = bibs[rand() % bibs.size()]; // a re-run
+    } else {
+      bib = 1 + rand() % MAX_BIB;
+    }
+    when += 1000000LL + rand() % 10000000;
+    TimeResult data;
+    time_result_from_epoch(&data, when);
+    format_race_line(line, bib, &data, false);
+    sd.writeFile(filename, line, false);
+    written++;
+    bibs.push_back(bib);
+    results.push_back(bib);
+    if (rand() % 15 == 0) {
+      int clears = 1 + rand() % 3;
+      for (int i = 0; i < clears && !results.empty() && written < lines; i++) {
+        char clear[] = "CLEAR_PREVIOUS";
+        sd.writeFile(filename, clear, false);
+        written++;
+        results.pop_back();
+      }
+    }
+  }
+  sd.drainQueue();
+  sd.closeAll();
+  return results;
+}
+
+// return the number of racers whose dUP would be wrong
+int check_racers_seen(const std::vector<int> &results) {
+  std::vector<bool> seen(MAX_BIB + 1, false);
+  for (size_t i = 0; i < results.size(); i++) {
+    seen[results[i]] = true;
+  }
+  int wrong = 0;
+  for (int bib = 0; bib <= MAX_BIB; bib++) {
+    if (duplicate_racer_number(bib) != seen[bib]) {
+      if (wrong++ < 10) {
+        printf("bib %d: %s\n", bib, seen[bib] ? "not found" : "found, but has no result");
+      }
+    }
+  }
+  return wrong;
+}
+
+int main(int argc, char **argv) {
+  int lines = argc > 1 ? atoi(argv[1]) : 5000;
+  if (lines < 1) {
+    printf("usage: race_index_scan [LINES]\n");
+    return 1;
+  }
+  Serial.echo = false; // only show the results
+  srand(1);
+  sd.setup();
+  config.setup();
+  std::vector<int> results = write_race_file(config.filename(), lines);
+
+  unsigned long reads = host_sd_block_reads;
+  unsigned long start_time = micros();
+  clock_t start_cpu = clock();
+  rebuild_race_index();
+  double cpu_ms = (clock() - start_cpu) * 1000.0 / CLOCKS_PER_SEC;
+  unsigned long elapsed = micros() - start_time;
+
+  int wrong = check_racers_seen(results);
+  printf("%d lines: %lu results indexed, %zu not cleared, %d racers wrong\n",
+    lines, race_index_entries, results.size(), wrong);
+  printf("scan: %.1f ms of CPU on this PC, SD card: %lu block reads, about %lu ms on the timer\n",
+    cpu_ms, host_sd_block_reads - reads, elapsed / 1000);
+  return wrong == 0 ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+// Runs Mode 4.5 (race_results.cpp) on a PC, against an SD card in memory (tools/host),
+// to check the results, and to see how many passes and how long it takes.
+//
+//   g++ -O2 -std=gnu++11 -I tools/host -I . -include Arduino.h -o race_results_sim tools/race_results_sim.cpp
+//   ./race_results_sim [RACERS]
+//
+// The start and finish files are written with the timer's own code (format_race_line, UniSd),
+// as by two timers: a start line which starts just before midnight, and a finish line which is
+// switched on after midnight (so each counts from a different race day, see race_minute).
+// The bibs are spread over 1..9999, with re-runs, CLEAR_PREVIOUS, early starts, DNS and DNF.
+// The results are checked against a simple join in std::map.
+//
+// The time reported is micros() of tools/host/SdFat.h, so it is an estimate of the card's time
+// on the timer, not a measurement (the timer logs the real one, "Results: ...").
+#include <algorithm>
+#include <map>
+#include "uni_sd.cpp"
+#include "uni_config.cpp"
+#include "event_log.cpp"
+#include "serial_log.cpp"
+#include "epoch_time.cpp"
+#include "journal.cpp"
+#include "clock_state.cpp"
+#include "clock_model.cpp"
+#include "nmea_parser.cpp"
+#include "recording.cpp"
+#include "race_results.cpp"
+
+// The rest of the timer, which recording.cpp uses, does nothing here
+UniDisplay::UniDisplay(int) {}
+void UniDisplay::duplicate() {}
+void UniDisplay::clear() {}
+void UniDisplay::sd() {}
+void UniDisplay::showNumber(int) {}
+void UniDisplay::showNumber(int, int) {}
+UniKeypad::UniKeypad(byte, byte, byte, byte, byte, byte, byte, byte) {}
+uint8_t UniKeypad::intFromChar(char) { return 0; }
+char UniKeypad::lastKeyPressed() { return NO_KEY; }
+UniGps::UniGps(int) {}
+bool UniGps::holdover() { return false; }
+UniBuzzer::UniBuzzer(int) {}
+void UniBuzzer::warning() {}
+void mode6_replay(JournalRecord *) {}
+void mode6_clear_results() {}
+bool currentTime(TimeResult *) { return false; }
+
+UniSd sd(10);
+UniConfig config;
+UniDisplay display(0x70);
+UniKeypad keypad(0, 0, 0, 0, 0, 0, 0, 0);
+UniGps gps(2);
+UniBuzzer buzzer(4);
+
+#define MAX_BIB 9999
+// 2018-06-30 23:58:00 UTC
+#define START_EPOCH_SECONDS 1530403080LL
+// Each racer takes 2.5 to 4.5 minutes, so the finish timer's first result is after midnight
+#define MIN_RIDE_MICROS 150000000LL
+#define RIDE_SPREAD_MICROS 120000000LL
+
+typedef struct {
+  bool started;
+  bool finished;
+  bool fault;
+  EpochMicros start;
+  EpochMicros finish;
+} ExpectedResult;
+
+std::map<int, ExpectedResult> expected;
+// Each file has up to RESULTS_MAX_CLEARED CLEAR_PREVIOUS lines
+int start_cleared = 0;
+int finish_cleared = 0;
+
+// A result, as one of the timers writes it
+void write_result(const char *filename, int bib, EpochMicros when, bool fault) {
+  TimeResult data;
+  time_result_from_epoch(&data, when);
+  char line[SD_LINE_LENGTH];
+  format_race_line(line, bib, &data, fault);
+  sd.writeFile(filename, line, false);
+}
+
+void write_clear_previous(const char *filename) {
+  char line[] = "CLEAR_PREVIOUS";
+  sd.writeFile(filename, line, false);
+}
+
+// A racer starts every 10 seconds or so, from 23:58
+void write_race_files(int racers, const char *start_filename, const char *finish_filename) {
+  std::map<int, bool> used;
+  EpochMicros when = START_EPOCH_SECONDS * 1000000LL;
+  std::vector<std::pair<EpochMicros, int> > finishes;
+  race_day_start = 0; // the start timer
+  for (int i = 0; i < racers; i++) {
+    int bib;
+    do {
+      bib = 1 + rand() % MAX_BIB;
+    } while (used[bib]);
+    used[bib] = true;
+    ExpectedResult &result = expected[bib];
+    when += 10000000LL + rand() % 1000000;
+    if (rand() % 50 == 0) {
+      // missed by the start timer (DNS)
+      result.finished = true;
+      result.finish = when + MIN_RIDE_MICROS;
+      finishes.push_back(std::make_pair(result.finish, bib));
+      continue;
+    }
+    if (rand() % 20 == 0 && start_cleared++ < RESULTS_MAX_CLEARED) {
+      // a false start, cancelled
+      write_result(start_filename, bib, when, false);
+      write_clear_previous(start_filename);
+      when += 5000000LL;
+    }
+    result.started = true;
+    result.fault = rand() % 25 == 0;
+    result.start = when;
+    write_result(start_filename, bib, when, result.fault);
+    if (rand() % 50 == 0) {
+      continue; // DNF
+    }
+    result.finished = true;
+    result.finish = when + MIN_RIDE_MICROS + rand() % RIDE_SPREAD_MICROS;
+    finishes.push_back(std::make_pair(result.finish, bib));
+  }
+  std::sort(finishes.begin(), finishes.end());
+  race_day_start = 0; // the finish timer, switched on after midnight
+  for (size_t i = 0; i < finishes.size(); i++) {
+    if (rand() % 40 == 0 && finish_cleared++ < RESULTS_MAX_CLEARED) {
+      // a wrong bib, cancelled
+      write_result(finish_filename, finishes[i].second == MAX_BIB ? 1 : finishes[i].second + 1, finishes[i].first, false);
+      write_clear_previous(finish_filename);
+    }
+    write_result(finish_filename, finishes[i].second, finishes[i].first, false);
+  }
+  sd.drainQueue();
+  sd.closeAll();
+}
+
+// return the number of results which are wrong
+int check_results(const char *filename) {
+  std::string contents = host_sd_contents(filename);
+  int wrong = 0;
+  size_t lines = 0;
+  size_t position = 0;
+  int last_bib = 0;
+  while (position < contents.size() && contents[position] != '\0') {
+    size_t end = contents.find('\n', position);
+    std::string line = contents.substr(position, end - position);
+    position = end + 1;
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    lines++;
+    int bib = atoi(line.c_str());
+    if (bib <= last_bib || expected.find(bib) == expected.end()) {
+      printf("Unexpected bib (or not in bib order): %s\n", line.c_str());
+      wrong++;
+      continue;
+    }
+    last_bib = bib;
+    ExpectedResult &result = expected[bib];
+    char should_be[40];
+    if (!result.started) {
+      snprintf(should_be, sizeof(should_be), "%d,DNS,0", bib);
+    } else if (!result.finished) {
+      snprintf(should_be, sizeof(should_be), "%d,DNF,%d", bib, result.fault);
+    } else {
+      EpochMicros elapsed = result.finish - result.start + (result.fault ? RESULTS_FAULT_PENALTY_SECONDS * 1000000LL : 0);
+      snprintf(should_be, sizeof(should_be), "%d,%lld.%06lld,%d", bib,
+        (long long)(elapsed / 1000000), (long long)(elapsed % 1000000), result.fault);
+    }
+    if (line != should_be) {
+      printf("Wrong result: %s, should be %s\n", line.c_str(), should_be);
+      wrong++;
+    }
+  }
+  if (lines != expected.size()) {
+    printf("%zu results, should be %zu\n", lines, expected.size());
+    wrong++;
+  }
+  return wrong;
+}
+
+int main(int argc, char **argv) {
+  int racers = argc > 1 ? atoi(argv[1]) : 300;
+  if (racers < 1 || racers > MAX_BIB) {
+    printf("RACERS must be 1..%d\n", MAX_BIB);
+    return 1;
+  }
+  srand(1);
+  sd.setup();
+  config.setup();
+  char start_filename[RESULTS_FILENAME_LENGTH];
+  char finish_filename[RESULTS_FILENAME_LENGTH];
+  char results_filename[RESULTS_FILENAME_LENGTH];
+  config.buildFilename(start_filename, RESULTS_FILENAME_LENGTH, "Start");
+  config.buildFilename(finish_filename, RESULTS_FILENAME_LENGTH, "Finish");
+  config.buildFilename(results_filename, RESULTS_FILENAME_LENGTH, "Results");
+  write_race_files(racers, start_filename, finish_filename);
+
+  unsigned long reads = host_sd_block_reads;
+  unsigned long writes = host_sd_block_writes;
+  unsigned long start_time = micros();
+  long count = compute_race_results();
+  unsigned long elapsed = micros() - start_time;
+  serial_log_flush();
+
+  int wrong = check_results(results_filename);
+  printf("%d racers: %ld results, %d wrong\n", racers, count, wrong);
+  printf("ResultsJoin: %zu bytes of stack, %d racers per chunk, %d chunks\n",
+    sizeof(ResultsJoin), RESULTS_CHUNK_RACERS, (racers + RESULTS_CHUNK_RACERS - 1) / RESULTS_CHUNK_RACERS);
+  printf("SD card: %lu block reads, %lu block writes, about %lu ms on the timer\n",
+    host_sd_block_reads - reads, host_sd_block_writes - writes, elapsed / 1000);
+  return wrong == 0 && count == racers ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+// Convert binary result files (see result_record.h) to the race file CSV layout.
+//
+// This runs on a PC, not on the timer:
+//   g++ -O2 -o results_to_csv tools/results_to_csv.cpp
+//   ./results_to_csv [--events] [--day YYYY-MM-DD] race_Expert_Up_Finish_1.bin > results.txt
+//
+// Records are read one at a time, so files of any size can be converted.
+// Torn or corrupt records are skipped (reported on stderr), by searching for
+// the next valid record.
+//
+// The minute column is counted from midnight (UTC) of --day, or of the first
+// record, in the same way as on the timer.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../result_record.h"
+
+#define SECONDS_PER_DAY 86400LL
+
+static bool print_events = false;
+static long long day_start = -1;
+
+// days since 1970-01-01, for a date in the Gregorian calendar
+static long long days_from_civil(int year, int month, int day) {
+  year -= month <= 2;
+  long long era = (year >= 0 ? year : year - 399) / 400;
+  long long year_of_era = year - era * 400;
+  long long day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  long long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+static void print_record(const ResultRecord *record) {
+  long long seconds = record->epoch_micros / 1000000;
+  long long sub_second = record->epoch_micros % 1000000;
+  if (day_start < 0) {
+    day_start = seconds - (seconds % SECONDS_PER_DAY);
+  }
+  long long minute = (seconds - day_start) / 60;
+  int second = seconds % 60;
+  int millisecond = sub_second / 1000;
+  int microsecond = sub_second % 1000;
+  int fault = (record->flags & RESULT_FLAG_FAULT) ? 1 : 0;
+
+  switch (record->type) {
+    case RESULT_RECORD_RESULT:
+      printf("%d,,%02lld,%02d,%03d,%d,%03d\n", record->racer_number, minute, second, millisecond, fault, microsecond);
+      break;
+    case RESULT_RECORD_CLEAR_PREVIOUS:
+      printf("CLEAR_PREVIOUS\n");
+      break;
+    case RESULT_RECORD_EVENT:
+      if (print_events && record->racer_number == RESULT_EVENT_SENSOR) {
+        long long time_of_day = seconds % SECONDS_PER_DAY;
+        printf("sensor: %2lld,%02lld,%02d,%03d,%d,%03d,%u\n", time_of_day / 3600, (time_of_day / 60) % 60,
+          second, millisecond, fault, microsecond, (unsigned)record->error_micros);
+      }
+      break;
+  }
+}
+
+// return false if the file can't be read
+static bool convert(FILE *file, const char *name) {
+  unsigned char buffer[sizeof(ResultRecord)];
+  size_t have = 0;
+  unsigned long long offset = 0; // of the start of the buffer
+  unsigned long skipped = 0;
+  unsigned long expected_sequence = 0;
+
+  while (true) {
+    have += fread(buffer + have, 1, sizeof(buffer) - have, file);
+    if (have < sizeof(buffer)) {
+      break;
+    }
+    ResultRecord record;
+    memcpy(&record, buffer, sizeof(record));
+    if (!result_record_valid(&record)) {
+      // move on by one byte, and look for the next record
+      memmove(buffer, buffer + 1, sizeof(buffer) - 1);
+      have--;
+      offset++;
+      skipped++;
+      continue;
+    }
+    if (skipped > 0) {
+      fprintf(stderr, "%s: skipped %lu corrupt bytes before offset %llu\n", name, skipped, offset);
+      skipped = 0;
+    }
+    if (expected_sequence != 0 && record.sequence != expected_sequence) {
+      fprintf(stderr, "%s: sequence %lu, expected %lu\n", name, (unsigned long)record.sequence, expected_sequence);
+    }
+    expected_sequence = record.sequence + 1;
+    print_record(&record);
+    have = 0;
+    offset += sizeof(buffer);
+  }
+  if (have > 0 || skipped > 0) {
+    fprintf(stderr, "%s: %lu bytes of partial record at the end\n", name, (unsigned long)(have + skipped));
+  }
+  return !ferror(file);
+}
+
+int main(int argc, char **argv) {
+  int first_file = 1;
+  while (first_file < argc && strncmp(argv[first_file], "--", 2) == 0) {
+    if (strcmp(argv[first_file], "--events") == 0) {
+      print_events = true;
+    } else if (strcmp(argv[first_file], "--day") == 0 && first_file + 1 < argc) {
+      int year, month, day;
+      if (sscanf(argv[++first_file], "%d-%d-%d", &year, &month, &day) != 3) {
+        fprintf(stderr, "--day must be YYYY-MM-DD\n");
+        return 2;
+      }
+      day_start = days_from_civil(year, month, day) * SECONDS_PER_DAY;
+    } else {
+      fprintf(stderr, "usage: %s [--events] [--day YYYY-MM-DD] [file.bin ...]\n", argv[0]);
+      return 2;
+    }
+    first_file++;
+  }
+
+  if (first_file == argc) {
+    return convert(stdin, "stdin") ? 0 : 1;
+  }
+  int result = 0;
+  for (int i = first_file; i < argc; i++) {
+    FILE *file = fopen(argv[i], "rb");
+    if (file == NULL) {
+      perror(argv[i]);
+      result = 1;
+      continue;
+    }
+    if (!convert(file, argv[i])) {
+      result = 1;
+    }
+    fclose(file);
+  }
+  return result;
+}
@@ -0,0 +1,181 @@
+// Measures how long writing one record to the SD card blocks the timer, on a PC, with the
+// card's costs estimated by tools/host/SdFat.h: as the timer used to write (testWrite(),
+// then open, println and close for every record), with the files kept open (UniSd::writeFile),
+// and with the files preallocated (UniSd::preallocate, appended by raw blocks).
+//
+//   g++ -O2 -std=gnu++11 -I tools/host -I . -include Arduino.h -o sd_write_latency tools/sd_write_latency.cpp
+//   ./sd_write_latency [CROSSINGS]
+//
+// Each crossing writes a line to the race file (synced straight away) and a line to the log
+// (synced by loop() within SD_SYNC_INTERVAL_MS), 1 to 3 seconds after the last one.
+// Reported for each kind of record: the median, 99th percentile and worst time in writeFile()
+// (the main loop is blocked for this long). Also the block writes per crossing.
+// The background syncs are reported separately, as loop() does them between crossings.
+// The worst write is the first to each file, which opens it (the files are opened once per race).
+// The preallocated sizes are those of recording.cpp, which are full after about 2500 crossings.
+#include <algorithm>
+#include <vector>
+#include "uni_sd.cpp"
+#include "serial_log.cpp"
+#include "event_log.h"
+
+#define SD_CS 10
+#define RACE_FILENAME "/race_Expert_Up_Finish_1.txt"
+#define LOG_FILENAME "/log_1.txt"
+#define RACE_FILE_PREALLOCATE 65536UL // as in recording.cpp
+
+typedef struct {
+  const char *name;
+  std::vector<unsigned long> race_records;
+  std::vector<unsigned long> log_records;
+  std::vector<unsigned long> syncs;
+  unsigned long block_writes;
+} LatencyResult;
+
+// What UniSd::writeFile() did before the files were kept open
+SdFat baseline_sd;
+
+bool baseline_test_write() {
+  baseline_sd.begin(SD_CS);
+  File test_file = baseline_sd.open("testfile.txt", FILE_WRITE);
+  int result = test_file.println("testing Write");
+  if (result > 0) {
+    test_file.close();
+    return true;
+  }
+  return false;
+}
+
+bool baseline_write(const char *filename, const char *text) {
+  if (!baseline_test_write()) {
+    return false;
+  }
+  File file = baseline_sd.open(filename, FILE_WRITE);
+  if (!file) {
+    return false;
+  }
+  bool result = file.println(text) > 0;
+  file.close();
+  return result;
+}
+
+void clear_card() {
+  host_sd_files.clear();
+  host_sd_disk.clear();
+  host_sd_block_reads = 0;
+  host_sd_block_writes = 0;
+  host_micros = 0;
+}
+
+void format_record(char *line, int crossing) {
+  snprintf(line, SD_LINE_LENGTH, "%d,10:%02d:%02d.%06d", crossing % 1000 + 1,
+    (crossing / 60) % 60, crossing % 60, (crossing * 7919) % 1000000);
+}
+
+void format_log(char *line, int crossing) {
+  snprintf(line, SD_LINE_LENGTH, "%lu,INFO,Racer %d finished", millis(), crossing % 1000 + 1);
+}
+
+// Time one write, in microseconds of the card's estimated time
+#define TIME_WRITE(result, write) do { \
+    unsigned long start = micros(); \
+    write; \
+    result.push_back(micros() - start); \
+  } while (0)
+
+// The time between crossings, with the main loop running
+void run_loop(UniSd *sd, LatencyResult *result) {
+  unsigned long until = millis() + 1000 + rand() % 2000;
+  while ((long)(until - millis()) > 0) {
+    if (sd != NULL) {
+      unsigned long start = micros();
+      sd->loop();
+      unsigned long taken = micros() - start;
+      if (taken > 0) {
+        result->syncs.push_back(taken);
+      }
+    }
+    host_micros += 1000;
+  }
+}
+
+void run_baseline(LatencyResult *result, int crossings) {
+  clear_card();
+  char line[SD_LINE_LENGTH];
+  for (int i = 0; i < crossings; i++) {
+    format_record(line, i);
+    TIME_WRITE(result->race_records, baseline_write(RACE_FILENAME, line));
+    format_log(line, i);
+    TIME_WRITE(result->log_records, baseline_write(LOG_FILENAME, line));
+    run_loop(NULL, result);
+  }
+  result->block_writes = host_sd_block_writes;
+}
+
+void run_uni_sd(LatencyResult *result, int crossings, bool preallocate) {
+  clear_card();
+  UniSd sd(SD_CS);
+  sd.setup();
+  if (preallocate) {
+    sd.preallocate(RACE_FILENAME, RACE_FILE_PREALLOCATE);
+    sd.preallocate(LOG_FILENAME, LOG_SEGMENT_SIZE);
+  }
+  unsigned long setup_writes = host_sd_block_writes;
+  char line[SD_LINE_LENGTH];
+  for (int i = 0; i < crossings; i++) {
+    format_record(line, i);
+    TIME_WRITE(result->race_records, sd.writeFile(RACE_FILENAME, line, true));
+    format_log(line, i);
+    TIME_WRITE(result->log_records, sd.writeFile(LOG_FILENAME, line, false));
+    run_loop(&sd, result);
+  }
+  sd.closeAll();
+  result->block_writes = host_sd_block_writes - setup_writes;
+}
+
+unsigned long percentile(std::vector<unsigned long> values, int percent) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[(values.size() - 1) * percent / 100];
+}
+
+void print_latency(const char *name, const std::vector<unsigned long> &values) {
+  printf("  %-16s median %5.1fms, 99%% %5.1fms, worst %5.1fms\n", name, percentile(values, 50) / 1000.0,
+    percentile(values, 99) / 1000.0, percentile(values, 100) / 1000.0);
+}
+
+void print_result(const LatencyResult *result) {
+  printf("%s: %.1f block writes per crossing\n", result->name,
+    (double)result->block_writes / result->race_records.size());
+  print_latency("race file line", result->race_records);
+  print_latency("log line", result->log_records);
+  if (!result->syncs.empty()) {
+    print_latency("loop() syncs", result->syncs);
+  }
+}
+
+int main(int argc, char **argv) {
+  int crossings = argc > 1 ? atoi(argv[1]) : 2000;
+  if (crossings < 1) {
+    printf("usage: sd_write_latency [CROSSINGS]\n");
+    return 1;
+  }
+  Serial.echo = false; // only show the results
+  LatencyResult results[3];
+  results[0].name = "open/close per record (before)";
+  results[1].name = "files kept open";
+  results[2].name = "files kept open, preallocated";
+  srand(1);
+  run_baseline(&results[0], crossings);
+  srand(1);
+  run_uni_sd(&results[1], crossings, false);
+  srand(1);
+  run_uni_sd(&results[2], crossings, true);
+  printf("%d crossings, a race file line and a log line each\n", crossings);
+  for (int i = 0; i < 3; i++) {
+    print_result(&results[i]);
+  }
+  return 0;
+}
@@ -1,5 +1,6 @@
 // BUZZER
 #include "uni_buzzer.h"
+#include "serial_log.h"
 #include <Arduino.h>
 
 UniBuzzer::UniBuzzer(int output)
@@ -9,7 +10,7 @@ UniBuzzer::UniBuzzer(int output)
 
 void UniBuzzer::setup() {
   pinMode(_output, OUTPUT);
-  Serial.println("Buzzer Done init");
+  SERIAL_INFO("Buzzer Done init");
 }
 
 void UniBuzzer::beep() {
@@ -34,3 +35,8 @@ void UniBuzzer::failure() {
   delay(200);
   tone(_output, 233, 200); // should be Failure music
 }
+
+// Like failure(), but returns straight away
+void UniBuzzer::warning() {
+  tone(_output, 233, 400);
+}
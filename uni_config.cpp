@@ -1,32 +1,92 @@
 // Persistent Configuration
 #include "uni_config.h"
 #include <string.h>
+#include <stddef.h>
+#include <EEPROM.h>
 
 #include "uni_sd.h"
+#include "crc16.h"
+#include "serial_log.h"
 extern UniSd sd;
 
 #define CONFIG_FILENAME "/config.txt"
+// The new config is written here, and then renamed to CONFIG_FILENAME
+#define CONFIG_TEMP_FILENAME "/config.tmp"
+// Longest config file which writeConfig() creates
+#define CONFIG_TEXT_LENGTH 200
+// The last line of the file is the CRC of the lines before it
+#define CONFIG_CRC_KEY "CRC"
+
+// A copy of the config is kept in EEPROM, so that startup doesn't need to read the SD card
+#define CONFIG_EEPROM_ADDRESS 0
+#define CONFIG_EEPROM_MAGIC 0x4346
+
+#define CONFIG_BOOL 0
+#define CONFIG_UINT8 1
+#define CONFIG_UINT16 2
+#define CONFIG_INT 3
+
+// A field of Config which is saved, as "KEY:value" lines in the config file
+typedef struct {
+  const char *key;
+  uint8_t type;
+  uint16_t offset; // in Config
+  int16_t min_value;
+  int16_t max_value;
+  int16_t default_value;
+} ConfigField;
+
+const ConfigField config_fields[] = {
+  { "START", CONFIG_BOOL, offsetof(Config, start), 0, 1, 1 },
+  { "DIFF", CONFIG_UINT8, offsetof(Config, difficulty), 0, 2, 0 },
+  { "UP", CONFIG_BOOL, offsetof(Config, up), 0, 1, 1 },
+  { "RACE", CONFIG_UINT8, offsetof(Config, race_number), 0, 9, 0 },
+  { "BIB_DIGITS", CONFIG_UINT8, offsetof(Config, bib_number_length), 3, 4, 3 },
+  { "COUNTDOWN", CONFIG_BOOL, offsetof(Config, start_line_countdown), 0, 1, 0 },
+  { "MERGE_GAP", CONFIG_UINT16, offsetof(Config, finish_line_spacing), 0, 999, DEFAULT_FINISH_LINE_SPACING },
+  { "MODE", CONFIG_INT, offsetof(Config, mode), 1, 6, 1 },
+};
+#define CONFIG_FIELD_COUNT (sizeof(config_fields) / sizeof(config_fields[0]))
+
+// Keys written by older firmware, which are read as their new key
+typedef struct {
+  const char *old_key;
+  const char *key;
+} ConfigAlias;
+
+const ConfigAlias config_aliases[] = {
+  { "SPACING", "MERGE_GAP" }, // the crossing lockout, now the gap under which blocks are merged
+};
+#define CONFIG_ALIAS_COUNT (sizeof(config_aliases) / sizeof(config_aliases[0]))
+
+// The EEPROM copy of the config
+typedef struct {
+  uint16_t magic;
+  uint16_t schema; // CRC of the field names, so that a changed config_fields isn't loaded
+  int16_t values[CONFIG_FIELD_COUNT];
+  uint16_t crc;
+} ConfigEeprom;
 
 UniConfig::UniConfig()
 {
 
 }
 
+// Load the config from EEPROM, or from the SD card if EEPROM doesn't have it
 void UniConfig::setup() {
-  // read Config
-  if (!readConfig()) {
-    _loadedFromDefault = true;
-    // Default Config, as the config file is not found
-    _config.start = true;
-    _config.difficulty = 0;
-    _config.up = true;
-    _config.race_number = 0;
-    _config.bib_number_length = 3;
-    _config.start_line_countdown = false;
-    _config.finish_line_spacing = 500;
-    _config.mode = 1;
+  setDefaults();
+  _loadedFromDefault = false;
+  if (readEeprom()) {
+    SERIAL_INFO("Config loaded from EEPROM");
+  } else if (readConfig(CONFIG_FILENAME, false)) {
+    writeEeprom();
+  } else if (readConfig(CONFIG_TEMP_FILENAME, true)) {
+    // power was lost while writing the config, finish the write
+    sd.replaceFile(CONFIG_TEMP_FILENAME, CONFIG_FILENAME);
+    writeEeprom();
   } else {
-    _loadedFromDefault = false;
+    // Default Config, as the config file is not found
+    _loadedFromDefault = true;
   }
 }
 
@@ -36,13 +96,17 @@ bool UniConfig::loadedFromDefault() {
 }
 
 char *UniConfig::filename() {
-  snprintf(_config.filename, FILENAME_MAX_LENGTH, "/race_%s_%s_%s_%d.txt",
+  buildFilename(_config.filename, FILENAME_MAX_LENGTH, _config.start ? "Start" : "Finish");
+  return _config.filename;
+}
+
+// The filename of a file for this race, e.g. line_name "Start" for the start line's results
+void UniConfig::buildFilename(char *filename, int max_length, const char *line_name) {
+  snprintf(filename, max_length, "/race_%s_%s_%s_%d.txt",
     _config.difficulty == 0 ? "Beginner" : _config.difficulty == 1 ? "Advanced" : "Expert",
     _config.up ? "Up" : "Down",
-    _config.start ? "Start" : "Finish",
+    line_name,
     _config.race_number);
-
-  return _config.filename;
 }
 
 // Start/difficulty/up/race_number
@@ -98,7 +162,7 @@ bool UniConfig::get_start_line_countdown() {
 
 // finish_line_spacing
 void UniConfig::reset_finish_line_spacing() {
-  _config.finish_line_spacing = 500;
+  _config.finish_line_spacing = DEFAULT_FINISH_LINE_SPACING;
 }
 void UniConfig::increment_finish_line_spacing(int ms) {
   _config.finish_line_spacing = (_config.finish_line_spacing + ms) % 1000;
@@ -118,93 +182,188 @@ void UniConfig::setMode(int mode) {
 }
 
 /* ******************* PRIVATE METHODS ******************* */
-// Return true if the string starts with prefix
-bool UniConfig::prefix(const char *str, const char *prefix)
-{
-  return strncmp(prefix, str, strlen(prefix)) == 0;
+int16_t config_get_field(Config *config, const ConfigField *field) {
+  uint8_t *address = (uint8_t *)config + field->offset;
+  switch (field->type) {
+    case CONFIG_BOOL:
+      return *(bool *)address ? 1 : 0;
+    case CONFIG_UINT8:
+      return *(uint8_t *)address;
+    case CONFIG_UINT16:
+      return *(uint16_t *)address;
+    default:
+      return *(int *)address;
+  }
 }
 
-// Return the value after the prefix
-char *UniConfig::value(const char *str, const char *prefix)
-{
-  char *result = (char *)str;
-  return result + strlen(prefix);
-}
-
-/* TODO, Refactor this into a condensed format?
-[
-  [&_config.start, "START:", "bool"],
-  [&_config.difficulty, "DIFFICULTY:", "int"],
-  etc
-]
-*/
-
-// Read the config, return true on success
-bool UniConfig::readConfig() {
-  int max_config_string = 100;
-  char data_string[max_config_string];
-  if (sd.readFile(CONFIG_FILENAME, data_string, max_config_string)) {
-    char *token;
-    token = strtok(data_string, "\n");
-    while(token != NULL) {
-      if (prefix(token, "START:")) {
-        _config.start = atoi(value(token, "START:")) == 1;
-      } else if (prefix(token, "DIFF:")) {
-        _config.difficulty = atoi(value(token, "DIFF:"));
-      } else if (prefix(token, "UP:")) {
-        _config.up = atoi(value(token, "UP:")) == 1;
-      } else if (prefix(token, "RACE:")) {
-        _config.race_number = atoi(value(token, "RACE:"));
-      } else if (prefix(token, "BIB_DIGITS:")) {
-        _config.bib_number_length = atoi(value(token, "BIB_DIGITS:"));
-      } else if (prefix(token, "COUNTDOWN:")) {
-        _config.start_line_countdown = atoi(value(token, "COUNTDOWN:")) == 1;
-      } else if (prefix(token, "SPACING:")) {
-        _config.finish_line_spacing = atoi(value(token, "SPACING:"));
-      } else if (prefix(token, "MODE:")) {
-        _config.mode = atoi(value(token, "MODE:"));
+// return false if the value is out of range (the field isn't changed)
+bool config_set_field(Config *config, const ConfigField *field, long value) {
+  if (value < field->min_value || value > field->max_value) {
+    return false;
+  }
+  uint8_t *address = (uint8_t *)config + field->offset;
+  switch (field->type) {
+    case CONFIG_BOOL:
+      *(bool *)address = value == 1;
+      break;
+    case CONFIG_UINT8:
+      *(uint8_t *)address = value;
+      break;
+    case CONFIG_UINT16:
+      *(uint16_t *)address = value;
+      break;
+    default:
+      *(int *)address = value;
+      break;
+  }
+  return true;
+}
+
+// CRC of the field names (see ConfigEeprom)
+uint16_t config_schema() {
+  uint16_t crc = 0xFFFF;
+  for (unsigned int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    crc = crc16_ccitt(config_fields[i].key, strlen(config_fields[i].key), crc);
+  }
+  return crc;
+}
+
+// State while reading the config file line by line (see sd_line_handler)
+Config parsing_config;
+uint16_t parsing_crc;
+bool parsing_crc_found;
+bool parsing_crc_valid;
+
+void parse_config_line(char *line) {
+  char *separator = strchr(line, ':');
+  if (parsing_crc_found || separator == NULL) {
+    // blank line, or after the CRC
+    return;
+  }
+  *separator = '\0';
+  char *value = separator + 1;
+  char *end;
+  long number = strtol(value, &end, 10);
+
+  if (strcmp(line, CONFIG_CRC_KEY) == 0) {
+    parsing_crc_found = true;
+    parsing_crc_valid = strtoul(value, NULL, 16) == parsing_crc;
+    return;
+  }
+  // the CRC covers each line, with a \n line ending
+  *separator = ':';
+  parsing_crc = crc16_ccitt(line, strlen(line), parsing_crc);
+  parsing_crc = crc16_ccitt("\n", 1, parsing_crc);
+  *separator = '\0';
+
+  const char *key = line;
+  for (unsigned int i = 0; i < CONFIG_ALIAS_COUNT; i++) {
+    if (strcmp(line, config_aliases[i].old_key) == 0) {
+      key = config_aliases[i].key;
+    }
+  }
+  for (unsigned int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    if (strcmp(key, config_fields[i].key) == 0) {
+      if (end == value || *end != '\0' || !config_set_field(&parsing_config, &config_fields[i], number)) {
+        SERIAL_WARNING("Invalid config value, using default: %s:%s", line, value);
+      } else {
+        SERIAL_DEBUG("Got Config: %s:%ld", line, number);
       }
-      Serial.println("Got Config: ");
-      Serial.println(token);
-      token = strtok(NULL, "\n"); // Next token
+      return;
     }
-    return true;
-  } else {
+  }
+  SERIAL_WARNING("Unknown config: %s", line);
+}
+
+void UniConfig::setDefaults() {
+  for (unsigned int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    config_set_field(&_config, &config_fields[i], config_fields[i].default_value);
+  }
+}
+
+// Read the config file, return true on success
+// Fields which are missing or invalid keep their current value.
+// Files written by older versions don't have a CRC line, so it is only required if require_crc
+bool UniConfig::readConfig(const char *filename, bool require_crc) {
+  parsing_config = _config;
+  parsing_crc = 0xFFFF;
+  parsing_crc_found = false;
+  parsing_crc_valid = false;
+  if (!sd.readLines(filename, &parse_config_line)) {
+    return false;
+  }
+  if ((parsing_crc_found && !parsing_crc_valid) || (require_crc && !parsing_crc_found)) {
+    SERIAL_ERROR("Config file is damaged: %s", filename);
     return false;
   }
+  _config = parsing_config;
+  return true;
 }
 
-// Writes the configuration to the SD Card
+// Load the EEPROM copy of the config, return false if it isn't valid
+bool UniConfig::readEeprom() {
+  ConfigEeprom saved;
+  EEPROM.get(CONFIG_EEPROM_ADDRESS, saved);
+  if (saved.magic != CONFIG_EEPROM_MAGIC || saved.schema != config_schema() ||
+      saved.crc != crc16_ccitt(&saved, offsetof(ConfigEeprom, crc))) {
+    return false;
+  }
+  Config loaded = _config;
+  for (unsigned int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    if (!config_set_field(&loaded, &config_fields[i], saved.values[i])) {
+      return false;
+    }
+  }
+  _config = loaded;
+  return true;
+}
+
+// Save a copy of the config in EEPROM (only bytes which have changed are written)
+void UniConfig::writeEeprom() {
+  ConfigEeprom saved;
+  memset(&saved, 0, sizeof(saved));
+  saved.magic = CONFIG_EEPROM_MAGIC;
+  saved.schema = config_schema();
+  for (unsigned int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+    saved.values[i] = config_get_field(&_config, &config_fields[i]);
+  }
+  saved.crc = crc16_ccitt(&saved, offsetof(ConfigEeprom, crc));
+  EEPROM.put(CONFIG_EEPROM_ADDRESS, saved);
+}
+
+// Writes the configuration to the SD Card, and EEPROM
 // the format is:
-// config_name|configuration value
+// KEY:value
+// ...
+// CRC:crc of the lines before (hex)
+//
+// It is written to a temporary file, which then replaces the config file,
+// so that a power cut leaves either the old or the new config
 bool UniConfig::writeConfig() {
-  int max_config_string = 100;
-  char data_string[max_config_string];
-  snprintf(data_string, max_config_string,
-    "%s%d\n"
-    "%s%d\n"
-    "%s%d\n"
-    "%s%d\n"
-    "%s%d\n"
-    "%s%d\n"
-    "%s%d\n"
-    "%s%d\n",
-    "START:", _config.start ? 1 : 0,
-    "DIFF:", _config.difficulty,
-    "UP:", _config.up ? 1 : 0,
-    "RACE:", _config.race_number,
-    "BIB_DIGITS:", _config.bib_number_length,
-    "COUNTDOWN:", _config.start_line_countdown ? 1 : 0,
-    "SPACING:", _config.finish_line_spacing,
-    "MODE:", _config.mode
-    );
-  sd.clearFile(CONFIG_FILENAME);
-  if (sd.writeFile(CONFIG_FILENAME, data_string)) {
-    Serial.println("Write File");
-    Serial.println(data_string);
+  char data_string[CONFIG_TEXT_LENGTH];
+  int length = 0;
+  for (unsigned int i = 0; i < CONFIG_FIELD_COUNT && length < CONFIG_TEXT_LENGTH; i++) {
+    length += snprintf(data_string + length, CONFIG_TEXT_LENGTH - length, "%s:%d\n",
+      config_fields[i].key, config_get_field(&_config, &config_fields[i]));
+  }
+  if (length < CONFIG_TEXT_LENGTH) {
+    uint16_t crc = crc16_ccitt(data_string, length);
+    length += snprintf(data_string + length, CONFIG_TEXT_LENGTH - length, "%s:%04X", CONFIG_CRC_KEY, crc);
+  }
+  if (length >= CONFIG_TEXT_LENGTH) {
+    SERIAL_ERROR("Config is too long to write");
+    return false;
+  }
+
+  writeEeprom();
+  sd.clearFile(CONFIG_TEMP_FILENAME);
+  if (sd.writeFile(CONFIG_TEMP_FILENAME, data_string) &&
+      sd.replaceFile(CONFIG_TEMP_FILENAME, CONFIG_FILENAME)) {
+    SERIAL_INFO("Wrote config file");
+    SERIAL_DEBUG("%s", data_string);
     return true;
   } else {
-    Serial.println("Failed to write config file");
+    SERIAL_ERROR("Failed to write config file");
     return false;
   }
 }
@@ -3,10 +3,11 @@
 
 #include <Arduino.h>
 
-// NOTE: Adjustments to this structure MUST ALSO
-// be reflected in the readConfig and writeConfig methods
-// or else the config won't persist/parse properly
+// NOTE: Fields which should persist MUST ALSO
+// be listed in config_fields (uni_config.cpp)
 #define FILENAME_MAX_LENGTH 100
+// sensor intervals closer than this (ms) are the same racer
+#define DEFAULT_FINISH_LINE_SPACING 100
 typedef struct {
   // filename parts
   bool start; //[T, F]
@@ -22,7 +23,7 @@ typedef struct {
   // Start line modes
   bool start_line_countdown;
 
-  // Finish line spacing
+  // Finish line spacing (ms), sensor intervals closer than this are merged into one crossing
   uint16_t finish_line_spacing;
 
   // Resume the race mode stored
@@ -59,14 +60,16 @@ class UniConfig
     int get_finish_line_spacing();
 
     char *filename();
+    void buildFilename(char *filename, int max_length, const char *line_name);
     int mode();
     void setMode(int mode);
     bool writeConfig();
   private:
-    bool readConfig();
+    bool readConfig(const char *filename, bool require_crc);
+    bool readEeprom();
+    void writeEeprom();
+    void setDefaults();
     bool _loadedFromDefault;
-    bool prefix(const char *str, const char *prefix);
-    char *value(const char *str, const char *prefix);
     Config _config;
 };
 #endif
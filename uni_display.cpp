@@ -2,6 +2,7 @@
 #include <Adafruit_GFX.h>
 #include "Adafruit_LEDBackpack.h"
 #include "uni_display.h"
+#include "serial_log.h"
 
 // 7-Segment codes for displaying some letters.
 // Right-most Octet:
@@ -34,7 +35,7 @@ UniDisplay::UniDisplay(int i2c_addr)
 
 void UniDisplay::setup() {
   _display.begin(_i2c_addr);
-  Serial.println("Display Done init");
+  SERIAL_INFO("Display Done init");
 }
 
 void UniDisplay::setBlink(bool blink) {
@@ -77,17 +78,17 @@ void UniDisplay::gps() {
   _display.writeDisplay();
 }
 
+// dUP - this racer number already has a result
+void UniDisplay::duplicate() {
+  _display.clear();
+  _display.writeDigitRaw(1, LETTER_D);
+  _display.writeDigitRaw(3, LETTER_U);
+  _display.writeDigitRaw(4, LETTER_P);
+  _display.writeDisplay();
+}
+
 void UniDisplay::showConfiguration(bool start, uint8_t difficulty, bool up, uint8_t number) {
-#if 0
-  Serial.print("Start: ");
-  Serial.println(start);
-  Serial.print("Dfificulty: ");
-  Serial.println(difficulty_to_letter_code(difficulty));
-  Serial.print("Up: ");
-  Serial.println(up);
-  Serial.print("Number: ");
-  Serial.println(number);
-#endif
+  SERIAL_DEBUG("Start: %d Difficulty: %d Up: %d Number: %u", start, difficulty_to_letter_code(difficulty), up, number);
   _display.writeDigitNum(0, start ? 0x5 : 0xf); // S or F
   _display.writeDigitNum(1, difficulty_to_letter_code(difficulty));
   _display.writeDigitRaw(3, up ? LETTER_U : LETTER_D);
@@ -13,6 +13,7 @@ class UniDisplay
     void sens();
     void sd();
     void gps();
+    void duplicate();
     void setBlink(bool blink);
     void showConfiguration(bool start, uint8_t difficulty, bool up, uint8_t number);
     void show(char);
@@ -2,84 +2,320 @@
 // - This file assumes that the GPS is connected on Serial2
 
 #include "uni_gps.h"
+#include "diagnostics.h"
+#include "serial_log.h"
 //#define GPSECHO
 
 UniGps::UniGps(int pps_signal_input)
 {
   _pps_signal_input = pps_signal_input;
-  _last_hour = 0;
+  _pps_pending = false;
+  _baud = GPS_DEFAULT_BAUD;
+  _configured = false;
+  _config_step = GPS_CONFIG_DONE;
+  _config_step_start = 0;
+  _sentences_flag = PMTK_ACK_NONE;
+  _pps_awaiting_label = false;
+  _unlabelled_pulses = 0;
+  _ambiguous_labels = 0;
+  _consecutive_mismatches = 0;
+  _checksum_minute_start = 0;
+  _checksum_failures_at_minute_start = 0;
+  _checksum_failures_per_minute = 0;
 }
 
 // Setup function, for initializin Per-second-interrupt singal, and monitoring for GPS data
 // over serial2
-void UniGps::setup(void (*interrupt_handler)()) {
+void UniGps::setup(capture_handler interrupt_handler) {
   newData = false;
   last_gps_print_time = millis();
   
-  Serial.println("GPS Initializing");
+  SERIAL_INFO("GPS Initializing");
   pinMode(_pps_signal_input, INPUT);
-  attachInterrupt(digitalPinToInterrupt(_pps_signal_input), interrupt_handler, RISING);
+  capture_attach(_pps_signal_input, interrupt_handler, RISING);
+  SERIAL_INFO("PPS using %s capture", capture_is_hardware(_pps_signal_input) ? "hardware" : "software");
   
-  Serial2.begin(9600);
-  Serial.println("GPS Done init");
+  configureReceiver();
+  SERIAL_INFO("GPS Done init");
+}
+
+// Configure the (MTK3339) receiver:
+// - faster baud rate
+// - only the sentences that we need for timing (RMC, GGA, ZDA)
+// - update rate
+// This only sends the first command, the rest is done by readData() as the
+// acknowledgements arrive (see continueConfiguration), so that it doesn't hold up the start-up.
+// If the receiver doesn't acknowledge, we carry on with whatever it sends by default.
+void UniGps::configureReceiver() {
+  char command[24];
+  Serial2.begin(GPS_DEFAULT_BAUD);
+  _baud = GPS_DEFAULT_BAUD;
+  _configured = false;
+  snprintf(command, sizeof(command), "PMTK251,%lu", (unsigned long)GPS_FAST_BAUD);
+  configStep(GPS_CONFIG_SWITCHING, command); // not acknowledged, the receiver just switches
+}
+
+// RMC, GGA, ZDA only
+#define GPS_SENTENCES_COMMAND "PMTK314,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0"
+
+// The next step of configureReceiver(), once the last one is acknowledged or timed out
+void UniGps::continueConfiguration() {
+  uint8_t flag = PMTK_ACK_NONE;
+  switch (_config_step) {
+    case GPS_CONFIG_SWITCHING:
+      if (millis() - _config_step_start < GPS_BAUD_SWITCH_MS) {
+        return;
+      }
+      Serial2.begin(GPS_FAST_BAUD);
+      _baud = GPS_FAST_BAUD;
+      configStep(GPS_CONFIG_SENTENCES_FAST, GPS_SENTENCES_COMMAND);
+      return;
+    case GPS_CONFIG_SENTENCES_FAST:
+    case GPS_CONFIG_SENTENCES_DEFAULT:
+      if (!gps.ackReceived(314, &flag) && millis() - _config_step_start < GPS_ACK_TIMEOUT_MS) {
+        return;
+      }
+      if (flag == PMTK_ACK_NONE) {
+        if (_config_step == GPS_CONFIG_SENTENCES_DEFAULT) {
+          SERIAL_WARNING("GPS did not acknowledge configuration, using its defaults");
+          _config_step = GPS_CONFIG_DONE;
+          return;
+        }
+        // Maybe the receiver didn't change baud rate, try again at the default rate
+        // (if it answered, even to refuse, it is at this baud rate)
+        SERIAL_WARNING("GPS did not answer at the fast baud rate");
+        Serial2.begin(GPS_DEFAULT_BAUD);
+        _baud = GPS_DEFAULT_BAUD;
+        configStep(GPS_CONFIG_SENTENCES_DEFAULT, GPS_SENTENCES_COMMAND);
+        return;
+      }
+      _sentences_flag = flag;
+      char command[24];
+      snprintf(command, sizeof(command), "PMTK220,%d", GPS_UPDATE_INTERVAL_MS);
+      configStep(GPS_CONFIG_RATE, command);
+      return;
+    case GPS_CONFIG_RATE:
+      if (!gps.ackReceived(220, &flag) && millis() - _config_step_start < GPS_ACK_TIMEOUT_MS) {
+        return;
+      }
+      _configured = flag == PMTK_ACK_SUCCESS && _sentences_flag == PMTK_ACK_SUCCESS;
+      _config_step = GPS_CONFIG_DONE;
+      SERIAL_INFO("GPS configured at baud: %lu", _baud);
+      return;
+  }
+}
+
+// Send the command for this step of the configuration, and wait for its answer
+void UniGps::configStep(uint8_t step, const char *command) {
+  sendCommand(command);
+  _config_step = step;
+  _config_step_start = millis();
+}
+
+// Send a command, adding the $, checksum and line ending
+void UniGps::sendCommand(const char *command) {
+  uint8_t checksum = 0;
+  for (const char *c = command; *c; c++) {
+    checksum ^= *c;
+  }
+  char checksum_string[6];
+  snprintf(checksum_string, sizeof(checksum_string), "*%02X\r\n", checksum);
+  Serial2.write('$');
+  Serial2.write(command);
+  Serial2.write(checksum_string);
+}
+
+unsigned long UniGps::baud() {
+  return _baud;
+}
+
+// Did the receiver accept our configuration
+bool UniGps::configured() {
+  return _configured;
+}
+
+// Is the receiver still being configured (see configureReceiver)
+bool UniGps::configuring() {
+  return _config_step != GPS_CONFIG_DONE;
 }
 
 // this method is triggered whenever we have GPS Lock and PPS
 // This means that this method is called exactly on the second
 // But not necessarily on EVERY second
-bool UniGps::synchronizeClocks(unsigned long current_millis) {
-  _last_pps_millis = current_millis;
-  // time is returned as hhmmsscc
-  unsigned long time;
-  unsigned long age; // I think that we can do something smart with `age` to deal with loss of lock...maybe?
-  gps.get_datetime(NULL, &time, &age);
-  byte hour = time / 1000000;
+// It runs in the PPS interrupt, so only records when the pulse happened,
+// the rest is done by synchronizeClocks() from the main loop.
+void UniGps::ppsReceived(unsigned long current_micros) {
+  if (_pps_pending) {
+    diag_record(DIAG_PPS_OVERRUN, _pending_pps_micros);
+  }
+  _pending_pps_micros = current_micros;
+  _pending_pps_millis = millis();
+  _pps_pending = true;
+}
+
+// Process the last PPS pulse (if any), called from the main loop
+// The pulse is then waiting for the NMEA sentence which says which second it was (see labelPulse)
+// return false if there was no pulse, or it was rejected by the clock model
+bool UniGps::synchronizeClocks() {
+  if (!_pps_pending) {
+    return false;
+  }
+  noInterrupts();
+  unsigned long pps_micros = _pending_pps_micros;
+  unsigned long pps_millis = _pending_pps_millis;
+  _pps_pending = false;
+  interrupts();
 
-  // Prevent hour from resetting, and causing the result data to be 'negative time'
-  if (hour < _last_hour) {
-    hour = hour + 24;
+  if (!_clock.addPulse(pps_micros)) {
+    SERIAL_WARNING("PPS rejected at: %lu", pps_micros);
+    return false;
+  }
+  if (_pps_awaiting_label) {
+    SERIAL_WARNING("PPS was never labelled by a sentence");
+    _unlabelled_pulses++;
+  }
+  _awaiting_pps_micros = pps_micros;
+  _awaiting_pps_millis = pps_millis;
+  _pps_awaiting_label = true;
+  return true;
+}
+
+// An RMC/ZDA sentence has been received at arrival_micros.
+// The receiver sends the sentence for a second shortly AFTER the PPS pulse for that second,
+// so it labels the last PPS pulse, if that was less than GPS_SENTENCE_MAX_DELAY_MICROS ago.
+// The label must also agree with the number of seconds since the previous labelled pulse,
+// otherwise the pair is ambiguous (e.g. a late sentence for the previous second), and is rejected.
+// return true if the pulse was labelled, and the clock state updated
+bool UniGps::labelPulse(unsigned long arrival_micros) {
+  if (!_pps_awaiting_label) {
+    return false;
   }
-  if (hour > _last_hour) {
-    _last_hour = hour;
+  if (arrival_micros - _awaiting_pps_micros > GPS_SENTENCE_MAX_DELAY_MICROS) {
+    SERIAL_WARNING("GPS sentence too long after the PPS, not using it");
+    _pps_awaiting_label = false;
+    _unlabelled_pulses++;
+    return false;
   }
 
+  // date is returned as ddmmyy, time is returned as hhmmsscc
+  unsigned long date;
+  unsigned long time;
+  unsigned long age;
+  gps.get_datetime(&date, &time, &age);
+  if (date == NMEA_INVALID_DATE || time == NMEA_INVALID_TIME) {
+    return false;
+  }
+  if (time % 100 != 0) {
+    // not on the second (faster update rate), wait for the next sentence
+    return false;
+  }
+  byte day = date / 10000;
+  byte month = (date / 100) % 100;
+  int year = 2000 + (date % 100);
+  byte hour = time / 1000000;
   byte minute = (time / 10000) % 100;
   byte second = (time / 100) % 100;
-  _last_gps_time_in_seconds = (hour * 3600) + (minute * 60) + second;
+  unsigned long epoch_seconds = epoch_seconds_from_date(year, month, day) + (hour * 3600UL) + (minute * 60) + second;
+
+  ClockState previous;
+  _clock_state.read(&previous);
+  unsigned long since_previous = _awaiting_pps_micros - previous.pps_micros;
+  if (previous.valid && since_previous < CLOCK_MODEL_MAX_GAP_SECONDS * 1000000UL) {
+    unsigned long expected = previous.gps_epoch_seconds + ((since_previous + 500000) / 1000000);
+    if (epoch_seconds != expected) {
+      _ambiguous_labels++;
+      _consecutive_mismatches++;
+      if (_consecutive_mismatches < 3) {
+        SERIAL_WARNING("GPS sentence doesn't match the PPS, not using it");
+        _pps_awaiting_label = false;
+        return false;
+      }
+      // the sentences consistently disagree with our previous label, trust them
+      SERIAL_WARNING("GPS sentences consistently disagree with the previous PPS label, re-labelling");
+    }
+  }
+  _consecutive_mismatches = 0;
+  _pps_awaiting_label = false;
+
+  // the sensor interrupt reads this, see clock_state.h
+  ClockState state;
+  state.valid = true;
+  state.pps_micros = _awaiting_pps_micros;
+  state.pps_millis = _awaiting_pps_millis;
+  state.gps_epoch_seconds = epoch_seconds;
+  state.drift_factor = _clock.driftFactor();
+  state.uncertainty_factor = _clock.uncertaintyFactor();
+  state.jitter_micros = _clock.jitterMicros();
+  _clock_state.write(&state);
   return true;
 }
 
 // return true on success
 // return false on error
-// return the current hour/minute in GPS time, including milliseconds from
-// the PPS pulse
-bool UniGps::current_time(TimeResult *output, unsigned long current_millis) {
-  unsigned long offset_milliseconds = (current_millis - _last_pps_millis);
-  output->millisecond = offset_milliseconds % 1000;
+// return the current GPS time (epoch, and hour/minute...), including milliseconds and
+// microseconds from the PPS pulse, corrected for the drift of the local clock
+bool UniGps::current_time(TimeResult *output, unsigned long current_micros) {
+  ClockState state;
+  _clock_state.read(&state);
+  uint64_t local_elapsed = (unsigned long)(current_micros - state.pps_micros);
+
+  // micros() wraps around every ~71 minutes (2^32 us),
+  // use millis() to count the wrap-arounds if we have gone that long without a PPS pulse
+  unsigned long offset_millis = millis() - state.pps_millis;
+  if (offset_millis > 2147000UL) {
+    while (offset_millis / 1000 > (unsigned long)(local_elapsed / 1000000) + 2147) {
+      local_elapsed += 4294967296ULL;
+    }
+  }
 
-  unsigned long current_seconds = _last_gps_time_in_seconds + (offset_milliseconds / 1000);
+  uint64_t elapsed = clock_correct(&state, local_elapsed);
+  unsigned long offset_seconds = elapsed / 1000000;
+  unsigned long sub_second = elapsed % 1000000;
 
-  output->second = current_seconds % 60;
-  output->minute = (current_seconds / 60) % 60;
-  output->hour = (current_seconds / 3600) % 24;
+  time_result_from_seconds(output, state.gps_epoch_seconds + offset_seconds, sub_second);
+  // the PPS timestamps (which the clock is corrected to) may be late, see input_capture.h
+  output->error_micros = clock_error_bound(&state, local_elapsed) + capture_latency_bound(_pps_signal_input);
 
   return true;
 }
 
 void UniGps::readData() {
+  synchronizeClocks();
   while (Serial2.available())
   {
     char c = Serial2.read();
     #ifdef GPSECHO
       Serial.write(c); // uncomment this line if you want to see the GPS data flowing
     #endif
-    if (gps.encode(c)) // Did a new valid sentence come in?
+    if (gps.encode(c)) { // Did a new valid sentence come in?
       newData = true;
+      uint8_t sentence = gps.lastSentence();
+      if (sentence == NMEA_SENTENCE_RMC || sentence == NMEA_SENTENCE_ZDA) {
+        labelPulse(micros());
+      }
+    }
+  }
+  if (_config_step != GPS_CONFIG_DONE) {
+    continueConfiguration();
+  }
+  countChecksumFailures();
+}
+
+// Every minute, store how many checksum failures there were in that minute
+void UniGps::countChecksumFailures() {
+  if (millis() - _checksum_minute_start < 60000UL) {
+    return;
   }
+  unsigned short failed;
+  gps.stats(NULL, NULL, &failed);
+  _checksum_failures_per_minute = failed - _checksum_failures_at_minute_start;
+  _checksum_failures_at_minute_start = failed;
+  _checksum_minute_start = millis();
 }
 
+// Has the GPS sent anything since power-on?
 bool UniGps::detected() {
-  return Serial2.available();
+  return charactersReceived() > 0 || Serial2.available();
 }
 
 void UniGps::printPeriodically() {
@@ -97,10 +333,8 @@ void UniGps::printPeriodically() {
 
 // Have we got GPS Lock, and accurate time?
 bool UniGps::lock() {
-  float flat, flon;
-  unsigned long fix_age; // returns +- latitude/longitude in degrees
-  gps.f_get_position(&flat, &flon, &fix_age);
-  if (fix_age == TinyGPS::GPS_INVALID_AGE) {
+  unsigned long fix_age = gps.fixAge();
+  if (fix_age == NMEA_INVALID_AGE) {
     return false;
   } else if (fix_age > 5000) {
     return false;
@@ -109,37 +343,55 @@ bool UniGps::lock() {
   }
 }
 
+// Have we lost the PPS, and are running on the local clock only?
+bool UniGps::holdover() {
+  ClockState state;
+  _clock_state.read(&state);
+  return state.valid && (millis() - state.pps_millis > 1500);
+}
+
+// Collect how well we are keeping time (for the mode 2 display, and the log)
+void UniGps::health(ClockHealth *output) {
+  const uint16_t *histogram = _clock.jitterHistogram();
+  for (uint8_t i = 0; i < CLOCK_MODEL_HISTOGRAM_BUCKETS; i++) {
+    output->jitter_histogram[i] = histogram[i];
+  }
+  output->missed_pulses = _clock.missedPulses();
+  output->extra_pulses = _clock.rejectedPulses();
+  output->unlabelled_pulses = _unlabelled_pulses + _ambiguous_labels;
+  output->checksum_failures_per_minute = _checksum_failures_per_minute;
+  output->drift_ppb = _clock.driftPpb();
+  output->calibrated = _clock.calibrated();
+  output->holdover = holdover();
+
+  ClockState state;
+  _clock_state.read(&state);
+  if (state.valid) {
+    TimeResult now;
+    current_time(&now, micros());
+    output->millis_since_pps = millis() - state.pps_millis;
+    output->error_micros = now.error_micros;
+  } else {
+    output->millis_since_pps = 0xFFFFFFFF;
+    output->error_micros = 0xFFFFFFFF;
+  }
+}
+
 void UniGps::printGPS() {
   unsigned long chars;
   unsigned short sentences, failed;
   
-  Serial.println("---------------------------");
-  Serial.println("GPS:");
-  if (newData)
-  {
-    float flat, flon;
-    unsigned long age;
-    gps.f_get_position(&flat, &flon, &age);
-    Serial.print("LAT=");
-    Serial.print(flat == TinyGPS::GPS_INVALID_F_ANGLE ? 0.0 : flat, 6);
-    Serial.print(" LON=");
-    Serial.print(flon == TinyGPS::GPS_INVALID_F_ANGLE ? 0.0 : flon, 6);
-    Serial.print(" SAT=");
-    Serial.print(gps.satellites() == TinyGPS::GPS_INVALID_SATELLITES ? 0 : gps.satellites());
-    Serial.print(" PREC=");
-    Serial.print(gps.hdop() == TinyGPS::GPS_INVALID_HDOP ? 0 : gps.hdop());
-    newData = false;
-  }
-  
   gps.stats(&chars, &sentences, &failed);
-  Serial.print(" CHARS=");
-  Serial.print(chars);
-  Serial.print(" SENTENCES=");
-  Serial.print(sentences);
-  Serial.print(" CSUM ERR=");
-  Serial.println(failed);
-  if (chars == 0)
-    Serial.println("** No characters received from GPS: check wiring **");
+  SERIAL_INFO("GPS: FIX=%u SAT=%u CHARS=%lu SENTENCES=%u CSUM ERR=%u",
+    gps.fixQuality(), gps.satellites(), chars, sentences, failed);
+  newData = false;
+  if (chars == 0) {
+    SERIAL_WARNING("** No characters received from GPS: check wiring **");
+  }
+
+  SERIAL_INFO("DRIFT PPB=%ld JITTER US=%lu REJECTED PPS=%lu %s",
+    _clock.driftPpb(), _clock.jitterMicros(), _clock.rejectedPulses(),
+    _clock.calibrated() ? (holdover() ? "HOLDOVER" : "CALIBRATED") : "UNCALIBRATED");
 }
 
 unsigned long UniGps::charactersReceived() {
@@ -149,18 +401,16 @@ unsigned long UniGps::charactersReceived() {
 }
 
 void UniGps::printGPSDate() {
-  int year;
-  byte month, day, hour, minute, second, hundredths;
-  unsigned long age;
-  gps.crack_datetime(&year, &month, &day, &hour, &minute, &second, &hundredths, &age);
-  if (age == TinyGPS::GPS_INVALID_AGE) {
-    Serial.println("********** ******** ");
+  unsigned long date, time, age;
+  gps.get_datetime(&date, &time, &age);
+  if (age == NMEA_INVALID_AGE) {
+    SERIAL_INFO("********** ******** ");
   }
   else
   {
-    char sz[32];
-    snprintf(sz, 32, "%02d/%02d/%02d %02d:%02d:%02d.%03d",
-        month, day, year, hour, minute, second, hundredths);
-    Serial.println(sz);
+    // date is ddmmyy, time is hhmmsscc
+    SERIAL_INFO("%02lu/%02lu/%02lu %02lu:%02lu:%02lu.%02lu",
+        (date / 100) % 100, date / 10000, date % 100,
+        time / 1000000, (time / 10000) % 100, (time / 100) % 100, time % 100);
   }
 }
@@ -1,36 +1,98 @@
 #ifndef UNI_GPS_H
 #define UNI_GPS_H
-#include <TinyGPS.h>
+#include "nmea_parser.h"
+#include "clock_model.h"
+#include "clock_state.h"
+#include "input_capture.h"
+#include "epoch_time.h"
 
+// The receiver starts at GPS_DEFAULT_BAUD, we ask it to switch to GPS_FAST_BAUD
+// so that the NMEA time arrives soon after the PPS pulse which it describes
+#define GPS_DEFAULT_BAUD 9600
+#define GPS_FAST_BAUD 115200
+// How often the receiver sends its sentences (100 for 10Hz, needs GPS_FAST_BAUD)
+#define GPS_UPDATE_INTERVAL_MS 1000
+#define GPS_ACK_TIMEOUT_MS 500
+// Time for PMTK251 to be sent at the old baud rate, before we change ours
+#define GPS_BAUD_SWITCH_MS 100
+// No acknowledgement (the other flags are in nmea_parser.h)
+#define PMTK_ACK_NONE 0xFF
+
+// Steps of configuring the receiver, done by readData() so that setup() doesn't wait for it
+#define GPS_CONFIG_SWITCHING 0        // PMTK251 sent at GPS_DEFAULT_BAUD
+#define GPS_CONFIG_SENTENCES_FAST 1   // PMTK314 sent at GPS_FAST_BAUD
+#define GPS_CONFIG_SENTENCES_DEFAULT 2 // PMTK314 sent again at GPS_DEFAULT_BAUD
+#define GPS_CONFIG_RATE 3             // PMTK220 sent
+#define GPS_CONFIG_DONE 4
+// A sentence which arrives later than this after a PPS pulse isn't used to label it
+#define GPS_SENTENCE_MAX_DELAY_MICROS 900000UL
+
+// How well we are keeping time, see UniGps::health()
 typedef struct {
-  byte hour;
-  byte minute;
-  byte second;
-  int millisecond;
-} TimeResult;
+  uint16_t jitter_histogram[CLOCK_MODEL_HISTOGRAM_BUCKETS]; // PPS intervals, by error (see clock_model.h)
+  unsigned long missed_pulses;       // seconds without a PPS pulse
+  unsigned long extra_pulses;        // PPS pulses which didn't line up (noise)
+  unsigned long unlabelled_pulses;   // PPS pulses without a matching sentence
+  unsigned short checksum_failures_per_minute; // over the last full minute
+  unsigned long millis_since_pps;    // 0xFFFFFFFF if we haven't had a PPS pulse yet
+  unsigned long error_micros;        // estimated error of the current time
+  long drift_ppb;
+  bool calibrated;
+  bool holdover;
+} ClockHealth;
 
 class UniGps
 {
   public:
     UniGps(int pps_signal_input);
-    void setup(void (*interrupt_handler)());
+    void setup(capture_handler interrupt_handler);
     void readData();
     bool detected();
     void printPeriodically();
-    bool current_time(TimeResult *, unsigned long current_millis);
+    bool current_time(TimeResult *, unsigned long current_micros);
     void printGPSDate();
     bool lock();
+    bool holdover();
     unsigned long charactersReceived();
-    bool synchronizeClocks(unsigned long current_millis);
+    unsigned long baud();
+    bool configured();
+    bool configuring();
+    void ppsReceived(unsigned long current_micros);
+    bool synchronizeClocks();
+    void health(ClockHealth *output);
   private:
     bool newData;
     uint32_t last_gps_print_time;
-    unsigned long _last_pps_millis;
-    unsigned long _last_gps_time_in_seconds;
-    byte _last_hour; // to prevent the 'hour' from wrapping around when GPS date advances
+    ClockStateBuffer _clock_state;
+    volatile bool _pps_pending;
+    volatile unsigned long _pending_pps_micros;
+    volatile unsigned long _pending_pps_millis;
+    // the last PPS pulse, waiting for the sentence which says which second it was
+    bool _pps_awaiting_label;
+    unsigned long _awaiting_pps_micros;
+    unsigned long _awaiting_pps_millis;
+    unsigned long _unlabelled_pulses;
+    unsigned long _ambiguous_labels;
+    uint8_t _consecutive_mismatches;
     int _pps_signal_input;
-    TinyGPS gps;
+    NmeaParser gps;
+    ClockModel _clock;
+    unsigned long _baud;
+    bool _configured;
+    uint8_t _config_step;
+    unsigned long _config_step_start;
+    uint8_t _sentences_flag; // the acknowledgement of PMTK314
+    // checksum failures, counted per minute
+    unsigned long _checksum_minute_start;
+    unsigned short _checksum_failures_at_minute_start;
+    unsigned short _checksum_failures_per_minute;
     void printGPS();
+    void configureReceiver();
+    void continueConfiguration();
+    void configStep(uint8_t step, const char *command);
+    void sendCommand(const char *command);
+    bool labelPulse(unsigned long arrival_micros);
+    void countChecksumFailures();
     
 };
 
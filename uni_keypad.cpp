@@ -1,5 +1,6 @@
 // - KEYPAD
 #include "uni_keypad.h"
+#include "serial_log.h"
 
 UniKeypad::UniKeypad(byte r1, byte r2, byte r3, byte r4, byte c1, byte c2, byte c3, byte c4)
 {
@@ -35,7 +36,7 @@ void UniKeypad::setup() {
   // Are declared in some form of long-term storage (like global static variables, etc).
   // Using 'locals' will NOT work.
   _keypad = new Keypad(makeKeymap (keyLayout), linePins, columnPins, 4, 4); 
-  Serial.println("Keypad Done init");
+  SERIAL_INFO("Keypad Done init");
   _keypad->setHoldTime(20000);
 }
 
@@ -93,11 +94,9 @@ void UniKeypad::printKeypress() {
   char read_key = _keypad->getKey();
 
   if (read_key != NO_KEY) {
-    Serial.println ("read");
-    Serial.println(read_key);
+    SERIAL_DEBUG("read %c", read_key);
     if (isDigit(read_key)) {
-      Serial.print("value: ");
-      Serial.println(intFromChar(read_key));
+      SERIAL_DEBUG("value: %u", intFromChar(read_key));
     } else {
 //      beep();
     }
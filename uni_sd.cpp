@@ -1,9 +1,28 @@
 // - SD
 #include "uni_sd.h"
+#include "serial_log.h"
 
 UniSd::UniSd(int cs)
 {
   _cs = cs;
+  _status = false;
+  _last_sync_time = 0;
+  _last_write_micros = 0;
+  _worst_write_micros = 0;
+  memset(_latency_histogram, 0, sizeof(_latency_histogram));
+  _block_owner = NULL;
+  _block_number = 0;
+  _block_dirty = false;
+  _queue_head = 0;
+  _queue_used = 0;
+  _queue_full_count = 0;
+  _write_error = false;
+  for (int i = 0; i < SD_CACHED_FILES; i++) {
+    _cache[i].filename[0] = '\0';
+    _cache[i].dirty = false;
+    _cache[i].last_used = 0;
+    _cache[i].preallocated = false;
+  }
 }
 
 void UniSd::setup() {
@@ -11,11 +30,27 @@ void UniSd::setup() {
   // returns 0 on failure
   _status = SD.begin(_cs);
   if (status()) {
-    Serial.println("SD initialization OK.");  
+    SERIAL_INFO("SD initialization OK.");
+    recoverPreallocate();
     return;
   }
-  Serial.println("SD initialization failed!");
-  
+  SERIAL_ERROR("SD initialization failed!");
+}
+
+// Write some of the queued lines (see queueWrite), and
+// sync any files which were written without an immediate sync
+void UniSd::loop() {
+  for (int i = 0; i < SD_QUEUE_WRITES_PER_LOOP && !queueEmpty(); i++) {
+    writeQueued();
+  }
+  if (millis() - _last_sync_time < SD_SYNC_INTERVAL_MS) {
+    return;
+  }
+  _last_sync_time = millis();
+  if (!sync()) {
+    // card removed? start again, so that the next write re-opens the files
+    reinitialize();
+  }
 }
 
 // Return true on success
@@ -28,7 +63,10 @@ bool UniSd::status() {
 // return true on success
 bool UniSd::testWrite() {
   File testFile;
-  bool newstatus = SD.begin(_cs);
+  drainQueue();
+  // SD.begin() invalidates any open files
+  closeAll();
+  SD.begin(_cs);
   testFile = SD.open("testfile.txt", FILE_WRITE);
   int result = testFile.println("testing Write");
   if (result > 0) {
@@ -40,38 +78,171 @@ bool UniSd::testWrite() {
 }
 
 // append the given text to the file, as well as finish with a newline character (ie: println)
-bool UniSd::writeFile(const char *filename, char *text) {
-  if (!testWrite()) {
+// The file is kept open for the next write.
+// If sync_now is false, the data is only guaranteed to be on the card after the next sync() (see loop())
+// Anything queued is written first, so that the lines stay in order.
+bool UniSd::writeFile(const char *filename, char *text, bool sync_now) {
+  drainQueue();
+  return writeNow(filename, text, strlen(text), (sync_now ? SD_QUEUE_SYNC : 0) | SD_QUEUE_LINE);
+}
+
+// Like writeFile(), but the queue is left to loop(), so this only waits for this one line.
+// Only for files which are never queued (e.g. the journal), or the lines would be out of order.
+bool UniSd::writeFileNow(const char *filename, const char *text, bool sync_now) {
+  return writeNow(filename, text, strlen(text), (sync_now ? SD_QUEUE_SYNC : 0) | SD_QUEUE_LINE);
+}
+
+// Like writeFile(), but returns straight away, the line is written by loop().
+// If the queue is full, everything is written now (so this is slow).
+// Errors are reported later, by takeWriteError().
+// return false if the queue was full, and the write failed
+bool UniSd::queueWrite(const char *filename, const char *text, bool sync_now) {
+  uint16_t length = strlen(text);
+  if (length > SD_QUEUE_TEXT_LENGTH - 1) {
+    length = SD_QUEUE_TEXT_LENGTH - 1;
+  }
+  return queueData(filename, text, length, (sync_now ? SD_QUEUE_SYNC : 0) | SD_QUEUE_LINE);
+}
+
+// Append binary data (e.g. a ResultRecord) in the background, see queueWrite()
+// The file must not be preallocated (it is appended normally).
+bool UniSd::queueBinary(const char *filename, const void *data, uint16_t length, bool sync_now) {
+  if (length > SD_QUEUE_TEXT_LENGTH) {
     return false;
   }
+  return queueData(filename, data, length, sync_now ? SD_QUEUE_SYNC : 0);
+}
 
-  // open the file. note that only one file can be open at a time,
-  // so you have to close this one before opening another.
-  myFile = SD.open(filename, FILE_WRITE);
+// Write binary data now, see writeFile()
+bool UniSd::writeBinary(const char *filename, const void *data, uint16_t length) {
+  drainQueue();
+  return writeNow(filename, (const char *)data, length, SD_QUEUE_SYNC);
+}
 
-  // if the file opened okay, write to it:
-  if (myFile) {
-    Serial.print("Writing: ");
-    Serial.println(text);
-    Serial.print(" to ");
-    Serial.println(filename);
-    if (!myFile.println(text)) {
-      myFile.close();
-      return false;
+// Size of the file (0 if it doesn't exist)
+uint32_t UniSd::fileSize(const char *filename) {
+  drainQueue();
+  if (!SD.exists(filename)) {
+    return 0;
+  }
+  SdCachedFile *cached = openCached(filename);
+  if (cached == NULL) {
+    return 0;
+  }
+  return cached->preallocated ? cached->logical_size : cached->file.fileSize();
+}
+
+bool UniSd::queueEmpty() {
+  return _queue_used == 0;
+}
+
+// Write everything which is queued
+void UniSd::drainQueue() {
+  while (!queueEmpty()) {
+    writeQueued();
+  }
+}
+
+// Number of times that queueWrite() had to wait for the queue to be written
+unsigned long UniSd::queueFullCount() {
+  return _queue_full_count;
+}
+
+// Has a queued write failed since the last call?
+bool UniSd::takeWriteError() {
+  bool result = _write_error;
+  _write_error = false;
+  return result;
+}
+
+// flags: SD_QUEUE_SYNC, SD_QUEUE_LINE (text, followed by a line ending)
+bool UniSd::writeNow(const char *filename, const char *data, uint16_t length, uint8_t flags) {
+  unsigned long start = micros();
+  bool result = append(filename, data, length, flags);
+  if (!result) {
+    // maybe the card was removed and re-inserted, start again
+    SERIAL_WARNING("SD write failed, re-initializing");
+    if (reinitialize()) {
+      result = append(filename, data, length, flags);
+    }
+  }
+  _last_write_micros = micros() - start;
+  if (_last_write_micros > _worst_write_micros) {
+    _worst_write_micros = _last_write_micros;
+  }
+  countLatency(_last_write_micros);
+
+  if (result) {
+    if (flags & SD_QUEUE_LINE) {
+      SERIAL_DEBUG("Writing: %.*s to %s done in us: %lu", length, data, filename, _last_write_micros);
+    } else {
+      SERIAL_DEBUG("Writing: %u bytes to %s done in us: %lu", length, filename, _last_write_micros);
     }
-    // close the file:
-    myFile.close();
-    Serial.println("done.");
-    return true;
   } else {
-    // if the file didn't open, print an error:
-    Serial.print("error opening ");
-    Serial.println(filename);
-    return false;
+    SERIAL_ERROR("error writing %s", filename);
   }
+  return result;
+}
+
+// Write all of the open files to the card
+// return false if any of them failed (e.g. card removed)
+bool UniSd::sync() {
+  bool result = true;
+  for (int i = 0; i < SD_CACHED_FILES; i++) {
+    if (_cache[i].filename[0] != '\0' && _cache[i].dirty) {
+      if (_cache[i].file.sync()) {
+        _cache[i].dirty = false;
+      } else {
+        SERIAL_ERROR("error syncing %s", _cache[i].filename);
+        result = false;
+      }
+    }
+  }
+  if (!flushBlock()) {
+    SERIAL_ERROR("error writing block");
+    result = false;
+  }
+  if (!result) {
+    _status = false;
+  }
+  return result;
+}
+
+// Sync and close all of the open files
+void UniSd::closeAll() {
+  for (int i = 0; i < SD_CACHED_FILES; i++) {
+    if (_cache[i].filename[0] != '\0') {
+      closeCached(_cache[i].filename);
+    }
+  }
+}
+
+// How long the last writeFile() took
+unsigned long UniSd::lastWriteMicros() {
+  return _last_write_micros;
+}
+
+// Longest writeFile() since power-on
+unsigned long UniSd::worstWriteMicros() {
+  return _worst_write_micros;
+}
+
+// Print how many writes took how long (see SD_LATENCY_BUCKETS)
+void UniSd::printLatency() {
+  const char *labels[SD_LATENCY_BUCKETS] = { "<1ms", "<2ms", "<5ms", "<10ms", "<20ms", "<50ms", ">=50ms" };
+  char line[SERIAL_LOG_LINE_LENGTH];
+  int length = 0;
+  for (int i = 0; i < SD_LATENCY_BUCKETS && length < (int)sizeof(line); i++) {
+    length += snprintf(line + length, sizeof(line) - length, " %s=%lu", labels[i], (unsigned long)_latency_histogram[i]);
+  }
+  SERIAL_INFO("SD write latency:%s", line);
 }
 
 bool UniSd::readFile(const char *filename, char *result, int max_result) {
+  // make sure that everything we wrote is on the card
+  drainQueue();
+  closeCached(filename);
+
   // re-open the file for reading:
   myFile = SD.open(filename);
 
@@ -83,8 +254,6 @@ bool UniSd::readFile(const char *filename, char *result, int max_result) {
   }
 
   if (myFile) {
-    Serial.println(filename);
-
     // read from the file until there's nothing else in it:
     int current_position = 0;
     while (myFile.available()) {
@@ -92,20 +261,630 @@ bool UniSd::readFile(const char *filename, char *result, int max_result) {
       if (current_position < max_result) {
         result[current_position++] = character;
       }
-
-      Serial.write(character);
     }
     // close the file:
     myFile.close();
+    SERIAL_DEBUG("Read %s bytes: %d", filename, current_position);
     return true;
   } else {
     // if the file didn't open, print an error:
-    Serial.print("error opening ");
-    Serial.println(filename);
+    SERIAL_ERROR("error opening %s", filename);
+    return false;
+  }
+}
+
+// Call the handler for each line of the file (without the line ending)
+// return false if the file can't be opened
+bool UniSd::readLines(const char *filename, sd_line_handler handler) {
+  drainQueue();
+  closeCached(filename);
+  myFile = SD.open(filename);
+  if (!myFile) {
+    return false;
+  }
+  char line[SD_LINE_LENGTH];
+  int length;
+  while ((length = myFile.fgets(line, sizeof(line))) > 0) {
+    if (line[0] == '\0') {
+      // the unused part of a preallocated file
+      break;
+    }
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+      line[--length] = '\0';
+    }
+    handler(line);
+  }
+  myFile.close();
+  return true;
+}
+
+// Read length bytes, starting at position, without reading the rest of the file
+// return the number of bytes read (-1 if the file couldn't be opened)
+int UniSd::readAt(const char *filename, uint32_t position, void *data, uint16_t length) {
+  drainQueue();
+  closeCached(filename);
+  myFile = SD.open(filename);
+  if (!myFile) {
+    return -1;
+  }
+  int count = -1;
+  if (myFile.seekSet(position)) {
+    count = myFile.read(data, length);
+  }
+  myFile.close();
+  return count;
+}
+
+// Open a file to be read a line at a time (see readLine), e.g. alongside readLines() of another file
+bool UniSd::openReader(const char *filename) {
+  drainQueue();
+  closeCached(filename);
+  _reader = SD.open(filename);
+  return _reader;
+}
+
+// The next line of the file opened by openReader() (without the line ending)
+// return its length, or -1 at the end of the file
+int UniSd::readLine(char *line, int max_length) {
+  if (!_reader) {
+    return -1;
+  }
+  int length = _reader.fgets(line, max_length);
+  if (length <= 0 || line[0] == '\0') {
+    // the end, or the unused part of a preallocated file
+    return -1;
+  }
+  while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+    line[--length] = '\0';
+  }
+  return length;
+}
+
+void UniSd::closeReader() {
+  _reader.close();
+}
+
+// Remove a partly-written last line (e.g. after a power cut), so that the next
+// write starts on a new line
+// return the number of complete lines in the file (0 if it doesn't exist)
+// return -1 on error
+long UniSd::repairFile(const char *filename) {
+  drainQueue();
+  closeCached(filename);
+  if (!SD.exists(filename)) {
+    return 0;
+  }
+  myFile = SD.open(filename, O_RDWR);
+  if (!myFile) {
+    return -1;
+  }
+  long lines = 0;
+  uint32_t complete_size = 0;
+  uint32_t position = 0;
+  bool preallocated = false; // the data ends at the first zero byte
+  uint8_t buffer[64];
+  int count;
+  while (!preallocated && (count = myFile.read(buffer, sizeof(buffer))) > 0) {
+    for (int i = 0; i < count; i++) {
+      if (buffer[i] == '\0') {
+        preallocated = true;
+        break;
+      }
+      position++;
+      if (buffer[i] == '\n') {
+        lines++;
+        complete_size = position;
+      }
+    }
+  }
+  if (complete_size < position) {
+    SERIAL_WARNING("Removing partial line from %s", filename);
+    if (preallocated) {
+      // keep the preallocated space, clear the partial line
+      memset(buffer, 0, sizeof(buffer));
+      myFile.seekSet(complete_size);
+      for (uint32_t remaining = position - complete_size; remaining > 0; ) {
+        uint32_t chunk = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+        myFile.write(buffer, chunk);
+        remaining -= chunk;
+      }
+    } else {
+      myFile.truncate(complete_size);
+    }
+  }
+  myFile.close();
+  return lines;
+}
+
+// Create the file with all of its space allocated in one piece, and zeroed, so that appending
+// only writes its data blocks, without allocating clusters, or updating the FAT and directory
+// (which is what makes some writes take many milliseconds).
+// Any data already in the file is copied to the start of the new file.
+// A file which is already preallocated is only made again if it has less than size bytes left.
+// return true if the file is preallocated
+bool UniSd::preallocate(const char *filename, uint32_t size) {
+  drainQueue();
+  SdCachedFile *cached = openCached(filename);
+  if (cached == NULL) {
+    return false;
+  }
+  if (cached->preallocated) {
+    // the last block is always left empty (see appendBlocks)
+    if (cached->logical_size + size <= (cached->block_count - 1) * SD_BLOCK_SIZE) {
+      return true;
+    }
+    // set its size to the data, which is copied below
+    if (!truncateCached(cached)) {
+      return false;
+    }
+  }
+  uint32_t existing_size = cached->file.fileSize();
+  closeCached(filename);
+  // the block buffer is used for the copy
+  if (!flushBlock()) {
+    return false;
+  }
+  _block_owner = NULL;
+
+  // + the empty last block (see findLogicalEnd)
+  uint32_t blocks = ((existing_size + size + SD_BLOCK_SIZE - 1) / SD_BLOCK_SIZE) + 1;
+  uint32_t first_block, last_block;
+  File file;
+  // a temp file left from before may be the only copy of another file
+  if (!recoverPreallocate()) {
+    return false;
+  }
+  // say which file the temp file replaces, before there is one
+  File target = SD.open(SD_PREALLOCATE_TARGET, FILE_WRITE);
+  bool marked = target && target.write(filename) == strlen(filename);
+  target.close();
+  if (!marked) {
+    SERIAL_ERROR("error preallocating %s", filename);
+    return false;
+  }
+  if (!file.createContiguous(SD_PREALLOCATE_TEMP, blocks * SD_BLOCK_SIZE) ||
+      !file.contiguousRange(&first_block, &last_block)) {
+    SERIAL_ERROR("error preallocating %s", filename);
+    file.close();
+    // the file itself hasn't been touched
+    recoverPreallocate();
+    return false;
+  }
+
+  File existing = SD.open(filename);
+  bool result = SD.card()->writeStart(first_block, blocks);
+  for (uint32_t i = 0; result && i < blocks; i++) {
+    memset(_block, 0, SD_BLOCK_SIZE);
+    if (existing) {
+      existing.read(_block, SD_BLOCK_SIZE);
+    }
+    result = SD.card()->writeData(_block);
+  }
+  result = SD.card()->writeStop() && result;
+  existing.close();
+  file.close();
+  // SdFat may have a copy of the blocks which we have just written
+  SD.cacheClear();
+
+  if (!result || !SD.remove(filename) || !SD.rename(SD_PREALLOCATE_TEMP, filename)) {
+    SERIAL_ERROR("error preallocating %s", filename);
+    // put back whichever copy is complete
+    recoverPreallocate();
+    return false;
+  }
+  SD.remove(SD_PREALLOCATE_TARGET);
+  SERIAL_INFO("Preallocated %s bytes: %lu", filename, (unsigned long)blocks * SD_BLOCK_SIZE);
+  return true;
+}
+
+// A power cut during preallocate() may leave SD_PREALLOCATE_TEMP, either as a partial copy
+// (the file itself is still there), or as the only copy (the file had been removed).
+// In the second case the temp file is renamed back, as with config.tmp (see UniConfig::setup)
+// return false if the temp file is still there
+bool UniSd::recoverPreallocate() {
+  if (!SD.exists(SD_PREALLOCATE_TEMP)) {
+    SD.remove(SD_PREALLOCATE_TARGET);
+    return true;
+  }
+  char target[SD_FILENAME_LENGTH];
+  int length = 0;
+  File file = SD.open(SD_PREALLOCATE_TARGET);
+  if (file) {
+    length = file.read(target, sizeof(target) - 1);
+    file.close();
+  }
+  if (length <= 0) {
+    // don't know which file it belongs to, so it is kept
+    SERIAL_ERROR("%s left from an unknown file", SD_PREALLOCATE_TEMP);
+    return false;
+  }
+  target[length] = '\0';
+  closeCached(target);
+  if (SD.exists(target)) {
+    if (!SD.remove(SD_PREALLOCATE_TEMP)) {
+      return false;
+    }
+  } else {
+    if (!SD.rename(SD_PREALLOCATE_TEMP, target)) {
+      SERIAL_ERROR("error recovering %s from %s", target, SD_PREALLOCATE_TEMP);
+      return false;
+    }
+    SERIAL_WARNING("Recovered %s from %s", target, SD_PREALLOCATE_TEMP);
+  }
+  SD.remove(SD_PREALLOCATE_TARGET);
+  return true;
+}
+
+// Set the size of a preallocated file to the data that has been written, so that it can be
+// read normally (e.g. at the end of the race)
+bool UniSd::finishFile(const char *filename) {
+  drainQueue();
+  if (!SD.exists(filename)) {
+    return true;
+  }
+  SdCachedFile *cached = openCached(filename);
+  if (cached == NULL) {
     return false;
   }
+  bool result = truncateCached(cached);
+  closeCached(filename);
+  return result;
+}
+
+// return true if the file has been preallocated, and not finished yet
+bool UniSd::preallocated(const char *filename) {
+  if (!SD.exists(filename)) {
+    return false;
+  }
+  SdCachedFile *cached = openCached(filename);
+  return cached != NULL && cached->preallocated;
 }
 
 bool UniSd::clearFile(const char *filename) {
+  drainQueue();
+  closeCached(filename);
   return SD.remove(filename);
 }
+
+// Rename from to to, replacing to (if it exists)
+// A power cut part-way through leaves from, so the caller should look for it
+// if to is missing (see UniConfig::setup)
+bool UniSd::replaceFile(const char *from, const char *to) {
+  drainQueue();
+  closeCached(from);
+  closeCached(to);
+  if (SD.exists(to) && !SD.remove(to)) {
+    return false;
+  }
+  return SD.rename(from, to);
+}
+
+/* ******************* PRIVATE METHODS ******************* */
+// Write the oldest queued line
+// return false if it failed
+bool UniSd::writeQueued() {
+  uint8_t flags = 0;
+  char filename[SD_FILENAME_LENGTH];
+  uint16_t length = 0;
+  char data[SD_QUEUE_TEXT_LENGTH];
+  // writes are only queued whole, so a part missing means the queue is damaged
+  if (!queueRead(&flags, 1) || !queueGetString(filename, SD_FILENAME_LENGTH) ||
+      !queueRead(&length, sizeof(length)) || length > SD_QUEUE_TEXT_LENGTH || !queueRead(data, length)) {
+    SERIAL_ERROR("SD queue damaged, dropped: %u bytes", _queue_used);
+    _queue_head = 0;
+    _queue_used = 0;
+    _write_error = true;
+    return false;
+  }
+  if (!writeNow(filename, data, length, flags)) {
+    _write_error = true;
+    return false;
+  }
+  return true;
+}
+
+// Add a write to the queue: flags, filename\0, length, data
+// If the queue is full, everything is written now
+bool UniSd::queueData(const char *filename, const void *data, uint16_t length, uint8_t flags) {
+  uint16_t filename_length = strlen(filename) + 1;
+  if (filename_length > SD_FILENAME_LENGTH) {
+    return false;
+  }
+  if (_queue_used + 1 + filename_length + sizeof(length) + length > SD_QUEUE_SIZE) {
+    SERIAL_WARNING("SD queue full, writing now");
+    _queue_full_count++;
+    drainQueue();
+    return writeNow(filename, (const char *)data, length, flags);
+  }
+  queuePut(&flags, 1);
+  queuePut(filename, filename_length);
+  queuePut(&length, sizeof(length));
+  queuePut(data, length);
+  return true;
+}
+
+// Add bytes to the end of the queue (the caller checks that there is space)
+void UniSd::queuePut(const void *data, uint16_t length) {
+  const char *bytes = (const char *)data;
+  for (uint16_t i = 0; i < length; i++) {
+    _queue[(_queue_head + _queue_used) % SD_QUEUE_SIZE] = bytes[i];
+    _queue_used++;
+  }
+}
+
+// Take bytes from the start of the queue
+// return false if the queue ran out first
+bool UniSd::queueRead(void *data, uint16_t length) {
+  char *bytes = (char *)data;
+  for (uint16_t i = 0; i < length; i++) {
+    if (_queue_used == 0) {
+      return false;
+    }
+    bytes[i] = _queue[_queue_head];
+    _queue_head = (_queue_head + 1) % SD_QUEUE_SIZE;
+    _queue_used--;
+  }
+  return true;
+}
+
+// Take a null-terminated string from the start of the queue
+// return false if the queue ran out before the end of the string
+bool UniSd::queueGetString(char *data, uint16_t max_length) {
+  uint16_t i = 0;
+  bool found = false;
+  while (_queue_used > 0 && !found) {
+    char c = _queue[_queue_head];
+    _queue_head = (_queue_head + 1) % SD_QUEUE_SIZE;
+    _queue_used--;
+    if (i < max_length) {
+      data[i++] = c;
+    }
+    found = c == '\0';
+  }
+  data[max_length - 1] = '\0';
+  return found;
+}
+
+bool UniSd::append(const char *filename, const char *data, uint16_t length, uint8_t flags) {
+  bool sync_now = flags & SD_QUEUE_SYNC;
+  if (!_status && !reinitialize()) {
+    return false;
+  }
+  SdCachedFile *cached = openCached(filename);
+  if (cached == NULL) {
+    return false;
+  }
+  cached->last_used = millis();
+  if (cached->preallocated) {
+    if (!(flags & SD_QUEUE_LINE)) {
+      // binary data may contain zeros, which would end a preallocated file
+      SERIAL_ERROR("Can't write binary data to a preallocated file");
+      return false;
+    }
+    if (appendBlocks(cached, data, length, sync_now)) {
+      return true;
+    }
+    if (cached->preallocated) {
+      closeCached(filename);
+      return false;
+    }
+    // the preallocated space is full, carry on appending normally
+  }
+  if (cached->file.write(data, length) != length ||
+      ((flags & SD_QUEUE_LINE) && cached->file.write("\r\n", 2) != 2)) {
+    closeCached(filename);
+    return false;
+  }
+  cached->dirty = true;
+  if (sync_now) {
+    if (!cached->file.sync()) {
+      closeCached(filename);
+      return false;
+    }
+    cached->dirty = false;
+  }
+  return true;
+}
+
+// Find the open file, or open it (closing the least recently used file if necessary)
+// return NULL if the file can't be opened
+SdCachedFile *UniSd::openCached(const char *filename) {
+  SdCachedFile *oldest = &_cache[0];
+  for (int i = 0; i < SD_CACHED_FILES; i++) {
+    if (_cache[i].filename[0] != '\0' && strcmp(_cache[i].filename, filename) == 0) {
+      return &_cache[i];
+    }
+    if (_cache[i].filename[0] == '\0') {
+      oldest = &_cache[i];
+    } else if (oldest->filename[0] != '\0' && _cache[i].last_used < oldest->last_used) {
+      oldest = &_cache[i];
+    }
+  }
+  if (strlen(filename) >= SD_FILENAME_LENGTH) {
+    return NULL;
+  }
+
+  if (oldest->filename[0] != '\0') {
+    closeCached(oldest->filename);
+  }
+  oldest->file = SD.open(filename, FILE_WRITE);
+  if (!oldest->file) {
+    return NULL;
+  }
+  strcpy(oldest->filename, filename);
+  oldest->dirty = false;
+  oldest->preallocated = findLogicalEnd(oldest);
+  return oldest;
+}
+
+// Sync and close the file, if it is open
+void UniSd::closeCached(const char *filename) {
+  for (int i = 0; i < SD_CACHED_FILES; i++) {
+    if (_cache[i].filename[0] != '\0' && strcmp(_cache[i].filename, filename) == 0) {
+      if (_block_owner == &_cache[i]) {
+        flushBlock();
+        _block_owner = NULL;
+      }
+      if (_cache[i].preallocated) {
+        // SdFat may have an old copy of the blocks which we have written directly
+        SD.cacheClear();
+      }
+      _cache[i].file.close();
+      _cache[i].filename[0] = '\0';
+      _cache[i].dirty = false;
+      _cache[i].preallocated = false;
+    }
+  }
+}
+
+// Start the card again (e.g. after it was removed)
+bool UniSd::reinitialize() {
+  closeAll();
+  _status = SD.begin(_cs);
+  return _status;
+}
+
+// Is this a preallocated file (one piece, the data followed by zeros)?
+// if so, find where the data ends
+bool UniSd::findLogicalEnd(SdCachedFile *cached) {
+  uint32_t size = cached->file.fileSize();
+  uint32_t last_block;
+  if (size == 0 || (size % SD_BLOCK_SIZE) != 0 ||
+      !cached->file.contiguousRange(&cached->first_block, &last_block)) {
+    return false;
+  }
+  cached->block_count = size / SD_BLOCK_SIZE;
+  flushBlock();
+  _block_owner = NULL;
+
+  // a preallocated file always has an empty last block
+  if (!SD.card()->readBlock(last_block, _block)) {
+    return false;
+  }
+  for (int i = 0; i < SD_BLOCK_SIZE; i++) {
+    if (_block[i] != 0) {
+      return false;
+    }
+  }
+
+  // find the first block which starts with a zero (the data is never zero)
+  uint32_t low = 0;
+  uint32_t high = cached->block_count;
+  while (low < high) {
+    uint32_t middle = (low + high) / 2;
+    if (!SD.card()->readBlock(cached->first_block + middle, _block)) {
+      return false;
+    }
+    if (_block[0] == 0) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+  if (high == 0) {
+    cached->logical_size = 0;
+    return true;
+  }
+  // the data ends in the block before that
+  if (!SD.card()->readBlock(cached->first_block + high - 1, _block)) {
+    return false;
+  }
+  uint32_t end = 0;
+  while (end < SD_BLOCK_SIZE && _block[end] != 0) {
+    end++;
+  }
+  cached->logical_size = ((high - 1) * SD_BLOCK_SIZE) + end;
+  return true;
+}
+
+// Append the line to a preallocated file, writing only its data blocks
+// return false if it failed, or the file is full (preallocated is then false)
+bool UniSd::appendBlocks(SdCachedFile *cached, const char *text, uint16_t length, bool sync_now) {
+  // the last block is always left empty, that is how we know that a file is preallocated
+  if (cached->logical_size + length + 2 > (cached->block_count - 1) * SD_BLOCK_SIZE) {
+    SERIAL_WARNING("Preallocated space is full: %s", cached->filename);
+    truncateCached(cached);
+    return false;
+  }
+  if (!loadBlock(cached)) {
+    return false;
+  }
+  for (uint16_t i = 0; i < length + 2; i++) {
+    char c = (i < length) ? text[i] : (i == length ? '\r' : '\n');
+    _block[cached->logical_size % SD_BLOCK_SIZE] = c;
+    _block_dirty = true;
+    cached->logical_size++;
+    if ((cached->logical_size % SD_BLOCK_SIZE) == 0) {
+      if (!flushBlock()) {
+        return false;
+      }
+      // the next block is already zero
+      memset(_block, 0, SD_BLOCK_SIZE);
+      _block_number++;
+    }
+  }
+  if (sync_now) {
+    return flushBlock();
+  }
+  return true;
+}
+
+// Make sure that the shared block buffer holds the block which the file is appending to
+bool UniSd::loadBlock(SdCachedFile *cached) {
+  uint32_t block = cached->first_block + (cached->logical_size / SD_BLOCK_SIZE);
+  if (_block_owner == cached && _block_number == block) {
+    return true;
+  }
+  if (!flushBlock()) {
+    return false;
+  }
+  _block_owner = NULL;
+  if (!SD.card()->readBlock(block, _block)) {
+    return false;
+  }
+  _block_owner = cached;
+  _block_number = block;
+  return true;
+}
+
+// Write the shared block buffer, if it has changed
+bool UniSd::flushBlock() {
+  if (_block_owner == NULL || !_block_dirty) {
+    return true;
+  }
+  if (!SD.card()->writeBlock(_block_number, _block)) {
+    return false;
+  }
+  _block_dirty = false;
+  return true;
+}
+
+// Set the size of a preallocated file to the data in it, after which it is an ordinary file
+bool UniSd::truncateCached(SdCachedFile *cached) {
+  if (!cached->preallocated) {
+    return true;
+  }
+  if (_block_owner == cached) {
+    if (!flushBlock()) {
+      return false;
+    }
+    _block_owner = NULL;
+  }
+  SD.cacheClear();
+  cached->preallocated = false;
+  if (!cached->file.truncate(cached->logical_size) || !cached->file.seekSet(cached->logical_size)) {
+    return false;
+  }
+  return cached->file.sync();
+}
+
+void UniSd::countLatency(unsigned long latency_micros) {
+  const unsigned long limits[SD_LATENCY_BUCKETS - 1] = { 1000, 2000, 5000, 10000, 20000, 50000 };
+  int bucket = 0;
+  while (bucket < SD_LATENCY_BUCKETS - 1 && latency_micros >= limits[bucket]) {
+    bucket++;
+  }
+  if (_latency_histogram[bucket] < 0xFFFF) {
+    _latency_histogram[bucket]++;
+  }
+}
@@ -3,6 +3,48 @@
 #include <SPI.h>
 #include "SdFat.h"
 
+// Number of files which we keep open (race file, journal, log, race index)
+#define SD_CACHED_FILES 4
+#define SD_FILENAME_LENGTH 40 // long enough for the race filenames (see UniConfig::filename)
+// Files written without an immediate sync are synced after this long
+#define SD_SYNC_INTERVAL_MS 1000
+
+// Longest line which readLines() returns (longer lines are split)
+#define SD_LINE_LENGTH 80
+
+#define SD_BLOCK_SIZE 512
+// Used while copying a file into its preallocated replacement
+#define SD_PREALLOCATE_TEMP "prealloc.tmp"
+// The name of the file which SD_PREALLOCATE_TEMP replaces, in case of a power cut
+#define SD_PREALLOCATE_TARGET "prealloc.nam"
+// RAM queue for queueWrite(), written in the background by loop()
+#define SD_QUEUE_SIZE 512
+#define SD_QUEUE_TEXT_LENGTH 160
+// Number of queued lines written per loop(), so that the loop stays responsive
+#define SD_QUEUE_WRITES_PER_LOOP 1
+// queued write flags
+#define SD_QUEUE_SYNC 0x01 // sync straight after writing
+#define SD_QUEUE_LINE 0x02 // text, followed by a line ending
+// writeFile() latency is counted in buckets: <1ms, <2ms, <5ms, <10ms, <20ms, <50ms, more
+#define SD_LATENCY_BUCKETS 7
+
+typedef void (*sd_line_handler)(char *line);
+
+// A file which we keep open between writes, so that each write doesn't
+// need to search the directory and FAT again
+typedef struct {
+  File file;
+  char filename[SD_FILENAME_LENGTH];
+  bool dirty; // written, but not synced
+  unsigned long last_used;
+  // A preallocated file (see preallocate()) is appended by writing its data blocks directly,
+  // its directory entry says that it is full size, the data ends at the first zero byte
+  bool preallocated;
+  uint32_t first_block;
+  uint32_t block_count;
+  uint32_t logical_size;
+} SdCachedFile;
+
 class UniSd
 {
   public:
@@ -11,14 +53,72 @@ class UniSd
     void loop();
     bool status();
     bool clearFile(const char *filename);
-    bool writeFile(const char *filename, char *text);
+    bool replaceFile(const char *from, const char *to);
+    bool writeFile(const char *filename, char *text, bool sync_now = true);
+    bool writeFileNow(const char *filename, const char *text, bool sync_now = true);
+    bool queueWrite(const char *filename, const char *text, bool sync_now = true);
+    bool queueBinary(const char *filename, const void *data, uint16_t length, bool sync_now = true);
+    bool writeBinary(const char *filename, const void *data, uint16_t length);
+    uint32_t fileSize(const char *filename);
+    bool queueEmpty();
+    void drainQueue();
+    unsigned long queueFullCount();
+    bool takeWriteError();
     bool readFile(const char *filename, char *result, int max_result);
     bool testWrite();
+    bool readLines(const char *filename, sd_line_handler handler);
+    int readAt(const char *filename, uint32_t position, void *data, uint16_t length);
+    bool openReader(const char *filename);
+    int readLine(char *line, int max_length);
+    void closeReader();
+    long repairFile(const char *filename);
+    bool preallocate(const char *filename, uint32_t size);
+    bool finishFile(const char *filename);
+    bool preallocated(const char *filename);
+    bool sync();
+    void closeAll();
+    unsigned long lastWriteMicros();
+    unsigned long worstWriteMicros();
+    void printLatency();
   private:
     int _cs;
     bool _status;
     SdFat SD;
     File myFile;
+    File _reader; // see openReader()
+    SdCachedFile _cache[SD_CACHED_FILES];
+    unsigned long _last_sync_time;
+    unsigned long _last_write_micros;
+    unsigned long _worst_write_micros;
+    uint16_t _latency_histogram[SD_LATENCY_BUCKETS];
+    // one block buffer, shared by the preallocated files
+    uint8_t _block[SD_BLOCK_SIZE];
+    SdCachedFile *_block_owner;
+    uint32_t _block_number;
+    bool _block_dirty;
+    // queued writes: flags, filename\0, length, data
+    char _queue[SD_QUEUE_SIZE];
+    uint16_t _queue_head;
+    uint16_t _queue_used;
+    unsigned long _queue_full_count;
+    bool _write_error;
+    SdCachedFile *openCached(const char *filename);
+    void closeCached(const char *filename);
+    bool reinitialize();
+    bool recoverPreallocate();
+    bool append(const char *filename, const char *data, uint16_t length, uint8_t flags);
+    bool writeNow(const char *filename, const char *data, uint16_t length, uint8_t flags);
+    bool writeQueued();
+    bool queueData(const char *filename, const void *data, uint16_t length, uint8_t flags);
+    void queuePut(const void *data, uint16_t length);
+    bool queueRead(void *data, uint16_t length);
+    bool queueGetString(char *data, uint16_t max_length);
+    bool findLogicalEnd(SdCachedFile *cached);
+    bool appendBlocks(SdCachedFile *cached, const char *text, uint16_t length, bool sync_now);
+    bool loadBlock(SdCachedFile *cached);
+    bool flushBlock();
+    bool truncateCached(SdCachedFile *cached);
+    void countLatency(unsigned long latency_micros);
 };
 
 #endif
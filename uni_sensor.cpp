@@ -1,13 +1,14 @@
 // SENSOR
 #include "Arduino.h"
 #include "uni_sensor.h"
+#include "serial_log.h"
 
 UniSensor::UniSensor(int input)
 {
   _input = input;
 }
 
-void UniSensor::setup(void (*interrupt_handler)()) {
+void UniSensor::setup(capture_handler interrupt_handler) {
   pinMode(_input, INPUT);
   _interrupt_handler = interrupt_handler;
 }
@@ -16,10 +17,22 @@ bool UniSensor::blocked() {
   return digitalRead(_input);
 }
 
+// The interrupt handler is given the micros() of the edge (blocked or cleared),
+// latched by the hardware if the sensor pin supports it
 void UniSensor::attach_interrupt() {
-  attachInterrupt(digitalPinToInterrupt(_input), _interrupt_handler, RISING);
+  capture_attach(_input, _interrupt_handler, CHANGE);
+  SERIAL_INFO("Sensor using %s capture", hardware_capture() ? "hardware" : "software");
 }
 
 void UniSensor::detach_interrupt() {
-  detachInterrupt(digitalPinToInterrupt(_input));
+  capture_detach(_input);
+}
+
+bool UniSensor::hardware_capture() {
+  return capture_is_hardware(_input);
+}
+
+// How late the timestamp of an edge may be (see capture_latency_bound)
+unsigned long UniSensor::capture_latency() {
+  return capture_latency_bound(_input);
 }
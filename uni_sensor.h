@@ -1,17 +1,20 @@
 #ifndef UNI_SENSOR_H
 #define UNI_SENSOR_H
+#include "input_capture.h"
 
 class UniSensor
 {
   public:
     UniSensor(int input);
-    void setup(void (*interrupt_handler)());
+    void setup(capture_handler interrupt_handler);
     bool blocked();
     void attach_interrupt();
     void detach_interrupt();
+    bool hardware_capture();
+    unsigned long capture_latency();
   private:
     int _input;
-    void (*_interrupt_handler)();
+    capture_handler _interrupt_handler;
 };
 
 #endif